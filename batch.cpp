@@ -0,0 +1,120 @@
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "batch.h"
+#include "uci.h"
+
+// Results are written as EPD: the first four fields of the input line followed by the best move (in
+// UCI notation), the score in centipawns for the side to move, dm for a forced mate, and the node
+// count and time spent. A line that isn't a valid position gets an error line in its place.
+std::string analyzePosition(const std::string &line, const SearchLimits &limits, TranspositionTable &tt) {
+    std::istringstream fields(line);
+    std::string position;
+    std::string field;
+    for (int i = 0; i < 4 && fields >> field; i++) {
+        position += (i ? " " : "") + field;
+    }
+    if (!isValidFen(position)) {
+        return "error invalid position: " + line;
+    }
+
+    Board board(position);
+    tt.newGeneration();
+    Evaluation e = evaluateBoard(board, limits, tt);
+    int value = board.whiteToMove ? e.pos.value : -e.pos.value;
+
+    std::ostringstream out;
+    out << position;
+    if (!e.pos.bestMovePath.empty()) {
+        out << " bm " << moveToUci(e.pos.bestMovePath[0]) << ';';
+    }
+    out << " ce " << value << ';';
+    if (isMateValue(value) && value > 0) {
+        out << " dm " << movesToMate(value) << ';';
+    }
+    out << " acn " << e.stats.methodCalls + e.stats.quiescenceNodes << ';'
+        << " acs " << e.stats.evaluationDurationMillis / 1000 << '.'
+        << std::to_string(1000 + e.stats.evaluationDurationMillis % 1000).substr(1) << ';';
+    return out.str();
+}
+
+struct BatchJob {
+    long seq;
+    std::string line;
+};
+
+// The reader fills a queue that the workers drain. Finished results wait in a reorder buffer until
+// every earlier one has been written. The reader stalls while it is a full window ahead of the
+// output, which bounds both the queue and the buffer.
+long runBatch(std::istream &in, std::ostream &out, const BatchOptions &options) {
+    int workerCount = std::max(options.workers, 1);
+    SearchLimits limits = options.limits;
+    limits.threads = 1;
+    long window = (long)workerCount * BATCH_WINDOW_PER_WORKER;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable windowAvailable;
+    std::deque<BatchJob> jobs;
+    std::map<long, std::string> results;
+    long nextToWrite = 0;
+    bool inputDone = false;
+
+    auto worker = [&]() {
+        TranspositionTable tt(options.hashMb);
+        while (true) {
+            BatchJob job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock, [&] { return !jobs.empty() || inputDone; });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            std::string result = analyzePosition(job.line, limits, tt);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            results.emplace(job.seq, std::move(result));
+            for (auto it = results.begin(); it != results.end() && it->first == nextToWrite; it = results.erase(it)) {
+                out << it->second << '\n';
+                nextToWrite++;
+            }
+            out.flush();
+            windowAvailable.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(worker);
+    }
+
+    long seq = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        windowAvailable.wait(lock, [&] { return seq - nextToWrite < window; });
+        jobs.push_back(BatchJob{seq++, line});
+        jobAvailable.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inputDone = true;
+    }
+    jobAvailable.notify_all();
+
+    for (std::thread &t : workers) {
+        t.join();
+    }
+    return seq;
+}
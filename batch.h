@@ -0,0 +1,26 @@
+#ifndef CHESS_BATCH_H
+#define CHESS_BATCH_H
+
+#include <istream>
+#include <ostream>
+
+#include "chess.h"
+
+const int BATCH_WINDOW_PER_WORKER = 4;
+
+// Each worker searches single threaded with its own transposition table, cleared before every
+// position so a result doesn't depend on which worker analyzed what before it.
+struct BatchOptions {
+    SearchLimits limits;
+    int workers = 1;
+    size_t hashMb = DEFAULT_HASH_MB;
+};
+
+std::string analyzePosition(const std::string &line, const SearchLimits &limits, TranspositionTable &tt);
+
+// Streams FEN/EPD lines from in and writes one result line per position to out, in input order.
+// At most BATCH_WINDOW_PER_WORKER positions per worker are read ahead of the output, so memory use
+// doesn't grow with the input. Returns the number of positions analyzed.
+long runBatch(std::istream &in, std::ostream &out, const BatchOptions &options);
+
+#endif //CHESS_BATCH_H
@@ -0,0 +1,253 @@
+#include "chess.h"
+#include "bitboard.h"
+
+const uint64_t ROOK_MAGIC_NUMBERS[64] = {
+    0x1080004008801020u, 0x0840092002C03000u, 0x1900200010400900u, 0x0880100008000480u,
+    0x4200100420080200u, 0x8100020100080400u, 0x0200040110886200u, 0x0200008040220411u,
+    0x0404800084400220u, 0x0000401000402000u, 0x0086001081220440u, 0x0408800800100280u,
+    0x000A001201040820u, 0x8848800200840080u, 0x4001000100040200u, 0x0442000102105084u,
+    0x9080010020804100u, 0x0040404000201009u, 0x0000808010002009u, 0x2200090021D00100u,
+    0x0008008008040080u, 0x0004004002010040u, 0x0011040008015042u, 0x00000A0001768104u,
+    0x0000800080204009u, 0x2010004140002001u, 0x9800200280100080u, 0x1000100080080080u,
+    0x0442000A00049020u, 0x2100040080020080u, 0x0800120400900148u, 0x0010040A00128541u,
+    0x2800804000800030u, 0x1010002000400041u, 0x4000200011004100u, 0x0610008410800800u,
+    0x0400802402800800u, 0xC100020080800400u, 0x0002000802000401u, 0x0182085882000401u,
+    0x0220204000808000u, 0x2860100040024022u, 0x0001002004110040u, 0x99101042000A0020u,
+    0x0004080004008080u, 0x0010040002008080u, 0x2012004881020004u, 0x8300842444820011u,
+    0x0088403882010200u, 0x0820400080210100u, 0x0110910040A00300u, 0x0801100280080480u,
+    0x0242009008200600u, 0x1002000489500200u, 0x0040800200010080u, 0x0091800041000080u,
+    0x0000209300488001u, 0x04C1002414824001u, 0x020020000B001041u, 0x7000100004200901u,
+    0x8002002004100802u, 0x30010002084C0007u, 0x0888221800813004u, 0x4000002840840112u,
+};
+
+const uint64_t BISHOP_MAGIC_NUMBERS[64] = {
+    0xA010041108003100u, 0x006082020A002900u, 0x6810010619200000u, 0x08281A0520000408u,
+    0x0001104001000400u, 0x0018901008048400u, 0x00040A0210245280u, 0x000200210808A402u,
+    0x9140048410821200u, 0x0800091010820041u, 0x20504804832202C0u, 0x0100091401081000u,
+    0x8021011140000012u, 0x0810020804450400u, 0x208B0542109008A2u, 0x0080084A08040204u,
+    0x0040E2A80811244Cu, 0x2505022008008108u, 0x0430220100420040u, 0x010A040420220040u,
+    0x1105000290400000u, 0x0093001200822120u, 0x4000A62048043004u, 0x280120048A015004u,
+    0x006090002A020814u, 0x44042000240800D0u, 0x01102800040A4400u, 0x1004080080220040u,
+    0x0001001011004024u, 0x0010044000805040u, 0x0914041200820100u, 0x0004821012821480u,
+    0x0024040500C05021u, 0x0088611002080200u, 0x0116080A00040020u, 0x4000020080080080u,
+    0x2450450140840040u, 0x0000880201484100u, 0x0222020404020092u, 0x8081110600002E00u,
+    0x2842101105000801u, 0x1100809008001025u, 0x00020202221C0400u, 0x0422014022009020u,
+    0x0210046102100C00u, 0xC004008082029102u, 0x00AA461801101200u, 0x0404080080201108u,
+    0x020542108C205002u, 0x0410544804100100u, 0x0040910841100000u, 0x0400200042021100u,
+    0x00004204850400C0u, 0x0200100410A42102u, 0x1040020801210102u, 0x0805040410420000u,
+    0x2884804130100200u, 0x800C262201242000u, 0x1058000194108800u, 0x0014221054420204u,
+    0x0104000012A02200u, 0x0200881003300100u, 0x0140400202840100u, 0x0402020801010201u,
+};
+
+Magic ROOK_MAGICS[64];
+Magic BISHOP_MAGICS[64];
+
+uint64_t ROOK_ATTACK_TABLE[102400];
+uint64_t BISHOP_ATTACK_TABLE[5248];
+
+const int ROOK_DIRECTIONS[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+const int BISHOP_DIRECTIONS[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+uint64_t slidingAttacks(int sq, uint64_t occupied, const int directions[4][2]) {
+    uint64_t attacks = 0;
+    for (int d = 0; d < 4; d++) {
+        int rank = sq / 8 + directions[d][0];
+        int file = sq % 8 + directions[d][1];
+        for (; onBoard(rank, file); rank += directions[d][0], file += directions[d][1]) {
+            setNthBit(attacks, rank * 8 + file);
+            if (getNthBit(occupied, rank * 8 + file)) {
+                break;
+            }
+        }
+    }
+    return attacks;
+}
+
+uint64_t *initMagics(Magic magics[64], const uint64_t magicNumbers[64], uint64_t *table, const int directions[4][2]) {
+    for (int sq = 0; sq < 64; sq++) {
+        int rank = sq / 8;
+        int file = sq % 8;
+        uint64_t edges = ((0xFFlu | (0xFFlu << 56u)) & ~(0xFFlu << (rank * 8u))) |
+                         ((0x0101010101010101lu | (0x0101010101010101lu << 7u)) & ~(0x0101010101010101lu << file));
+
+        Magic &m = magics[sq];
+        m.mask = slidingAttacks(sq, 0, directions) & ~edges;
+        m.magic = magicNumbers[sq];
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = table;
+
+        // Walk every subset of the mask with the carry-rippler trick.
+        uint64_t subset = 0;
+        do {
+            table[(subset * m.magic) >> m.shift] = slidingAttacks(sq, subset, directions);
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+        table += 1lu << popCount(m.mask);
+    }
+    return table;
+}
+
+// The magic attack tables are too large to build at compile time, unlike the ones in AttackTables.
+void initBitBoards() {
+    initMagics(ROOK_MAGICS, ROOK_MAGIC_NUMBERS, ROOK_ATTACK_TABLE, ROOK_DIRECTIONS);
+    initMagics(BISHOP_MAGICS, BISHOP_MAGIC_NUMBERS, BISHOP_ATTACK_TABLE, BISHOP_DIRECTIONS);
+}
+
+struct BitBoardInitializer {
+    BitBoardInitializer() {
+        initBitBoards();
+    }
+} bitBoardInitializer;
+
+#ifdef CHESS_BITBOARD
+
+bool isSquareAttacked(const Board &b, int sq, bool byWhite, uint64_t occupied) {
+    uint64_t attackers = b.colorBitBoards[colorIdx(byWhite)];
+    const uint64_t *pieces = b.pieceBitBoards;
+    return (ATTACKS.pawn[colorIdx(!byWhite)][sq] & pieces[PAWN] & attackers) ||
+           (ATTACKS.knight[sq] & pieces[KNIGHT] & attackers) ||
+           (ATTACKS.king[sq] & pieces[KING] & attackers) ||
+           (bishopAttacks(sq, occupied) & (pieces[BISHOP] | pieces[QUEEN]) & attackers) ||
+           (rookAttacks(sq, occupied) & (pieces[ROOK] | pieces[QUEEN]) & attackers);
+}
+
+bool inCheck(const Board &b, bool isWhite) {
+    const PieceElement &king(isWhite ? b.whitePieces[0] : b.blackPieces[0]);
+    uint64_t occupied = b.colorBitBoards[0] | b.colorBitBoards[1];
+    return isSquareAttacked(b, getBitIdx(king.rank, king.file), !isWhite, occupied);
+}
+
+template<Color C>
+void addMovesForTargets(MoveList &moves, const Board &b, const PieceElement &pe, uint64_t targets) {
+    for (; targets; popLsb(targets)) {
+        int sq = lsbIdx(targets);
+        int tRank = sqRank(sq);
+        int tFile = sqFile(sq);
+        uint8_t boardRes = b.boardMap[getBitIdx(tRank, tFile)];
+        uint8_t captureType = EMPTY;
+        uint8_t captureIdx = 0;
+        if (boardRes != EMPTY) {
+            captureIdx = boardRes - listStart(opponent(C));
+            captureType = b.pieces<opponent(C)>()[captureIdx].pieceType;
+        }
+
+        if (pe.pieceType == PAWN && tRank == adjRank(C == WHITE ? 8 : 1)) {
+            moves.push_back(Move(PAWN, pe.rank, pe.file, tRank, tFile, captureType, captureIdx, QUEEN));
+            moves.push_back(Move(PAWN, pe.rank, pe.file, tRank, tFile, captureType, captureIdx, ROOK));
+            moves.push_back(Move(PAWN, pe.rank, pe.file, tRank, tFile, captureType, captureIdx, BISHOP));
+            moves.push_back(Move(PAWN, pe.rank, pe.file, tRank, tFile, captureType, captureIdx, KNIGHT));
+        } else {
+            moves.push_back(Move(pe.pieceType, pe.rank, pe.file, tRank, tFile, captureType, captureIdx, 0));
+        }
+    }
+}
+
+template<Color C>
+uint64_t pawnTargets(int sq, uint64_t occupied, uint64_t enemies) {
+    constexpr int forward = 8 * pawnDirection(C);
+    uint64_t targets = ATTACKS.pawn[C][sq] & enemies;
+    if (!getNthBit(occupied, sq + forward)) {
+        setNthBit(targets, sq + forward);
+        if (sq / 8 == (C == WHITE ? 1 : 6) && !getNthBit(occupied, sq + 2 * forward)) {
+            setNthBit(targets, sq + 2 * forward);
+        }
+    }
+    return targets;
+}
+
+template<Color C>
+MoveList getMoves(const Board &b, const BoardContext &bc) {
+    MoveList moves;
+    const PieceList &pieces = b.pieces<C>();
+    uint64_t own = b.colorBitBoards[C];
+    uint64_t enemies = b.colorBitBoards[opponent(C)];
+    uint64_t occupied = own | enemies;
+    int kingSq = getBitIdx(pieces[0].rank, pieces[0].file);
+
+    for (const PieceElement &pe : pieces) {
+        int sq = getBitIdx(pe.rank, pe.file);
+        if (pe.pieceType == KING) {
+            addMovesForTargets<C>(moves, b, pe, ATTACKS.king[sq] & ~own & ~bc.attacked);
+            continue;
+        } else if (!bc.checkMask) {
+            continue;
+        }
+
+        uint64_t targets;
+        switch (pe.pieceType) {
+            case QUEEN:
+                targets = queenAttacks(sq, occupied) & ~own;
+                break;
+            case ROOK:
+                targets = rookAttacks(sq, occupied) & ~own;
+                break;
+            case BISHOP:
+                targets = bishopAttacks(sq, occupied) & ~own;
+                break;
+            case KNIGHT:
+                targets = ATTACKS.knight[sq] & ~own;
+                break;
+            case PAWN:
+                targets = pawnTargets<C>(sq, occupied, enemies);
+                break;
+            default:
+                continue;
+        }
+        targets &= bc.checkMask;
+        if (getNthBit(bc.pinned, sq)) {
+            targets &= ATTACKS.line[kingSq][sq];
+        }
+        addMovesForTargets<C>(moves, b, pe, targets);
+    }
+    return moves;
+}
+
+MoveList getMoves(Board &b, const BoardContext &bc) {
+    return b.whiteToMove ? getMoves<WHITE>(b, bc) : getMoves<BLACK>(b, bc);
+}
+
+BoardContext::BoardContext(const Board &b) {
+    const PieceElement &k(b.whiteToMove ? b.whitePieces[0] : b.blackPieces[0]);
+    int kingSq = getBitIdx(k.rank, k.file);
+    uint64_t own = b.colorBitBoards[colorIdx(b.whiteToMove)];
+    uint64_t enemies = b.colorBitBoards[colorIdx(!b.whiteToMove)];
+    uint64_t occupied = own | enemies;
+    const uint64_t *pieces = b.pieceBitBoards;
+
+    checkers = ((ATTACKS.pawn[colorIdx(b.whiteToMove)][kingSq] & pieces[PAWN]) |
+                (ATTACKS.knight[kingSq] & pieces[KNIGHT])) & enemies;
+    uint64_t evasions = 0;
+    uint64_t sliders = (((pieces[BISHOP] | pieces[QUEEN]) & bishopAttacks(kingSq, 0)) |
+                        ((pieces[ROOK] | pieces[QUEEN]) & rookAttacks(kingSq, 0))) & enemies;
+    for (; sliders; popLsb(sliders)) {
+        int sliderSq = lsbIdx(sliders);
+        uint64_t blockers = ATTACKS.between[kingSq][sliderSq] & occupied;
+        if (!blockers) {
+            setNthBit(checkers, sliderSq);
+            evasions |= ATTACKS.between[kingSq][sliderSq];
+        } else if (popCount(blockers) == 1 && (blockers & own)) {
+            pinned |= blockers;
+        }
+    }
+    if (checkers) {
+        checkMask = popCount(checkers) > 1 ? 0 : checkers | evasions;
+    }
+
+    // The king is left out of the blockers so it can't step back along the ray it is checked on.
+    uint64_t occupiedWithoutKing = occupied ^ (1lu << kingSq);
+    for (uint64_t bb = pieces[PAWN] & enemies; bb; popLsb(bb)) {
+        attacked |= ATTACKS.pawn[colorIdx(!b.whiteToMove)][lsbIdx(bb)];
+    }
+    for (uint64_t bb = pieces[KNIGHT] & enemies; bb; popLsb(bb)) {
+        attacked |= ATTACKS.knight[lsbIdx(bb)];
+    }
+    for (uint64_t bb = (pieces[BISHOP] | pieces[QUEEN]) & enemies; bb; popLsb(bb)) {
+        attacked |= bishopAttacks(lsbIdx(bb), occupiedWithoutKing);
+    }
+    for (uint64_t bb = (pieces[ROOK] | pieces[QUEEN]) & enemies; bb; popLsb(bb)) {
+        attacked |= rookAttacks(lsbIdx(bb), occupiedWithoutKing);
+    }
+    attacked |= ATTACKS.king[lsbIdx(pieces[KING] & enemies)];
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef CHESS_BITBOARD_H
+#define CHESS_BITBOARD_H
+
+#include <cstdint>
+
+#define lsbIdx(bitBoard) (__builtin_ctzll(bitBoard))
+#define popCount(bitBoard) (__builtin_popcountll(bitBoard))
+#define popLsb(bitBoard) ((bitBoard) &= (bitBoard) - 1)
+
+// Fancy magic bitboards: the relevant blockers of a square are multiplied by a magic number so that
+// the top bits index that square's slice of a shared attack table.
+struct Magic {
+    uint64_t mask;
+    uint64_t magic;
+    const uint64_t *attacks;
+    uint8_t shift;
+};
+
+extern Magic ROOK_MAGICS[64];
+extern Magic BISHOP_MAGICS[64];
+
+// Rank and file steps of the eight directions, straight ones first.
+constexpr int DIRECTIONS[8][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+const int FIRST_DIAGONAL = 4;
+const int NO_DIRECTION = -1;
+
+// Lookup tables over squares (a1 = 0), shared by both move generators. line is both squares and
+// the rest of the line through them, between only the squares strictly between them, and direction
+// the index into DIRECTIONS leading from the first square to the second. All three are empty
+// (NO_DIRECTION) for squares that aren't on a common rank, file or diagonal.
+struct AttackTables {
+    uint64_t knight[64];
+    uint64_t king[64];
+    uint64_t pawn[2][64];
+    uint64_t line[64][64];
+    uint64_t between[64][64];
+    int8_t direction[64][64];
+};
+
+constexpr bool onBoard(int rank, int file) {
+    return rank >= 0 && rank < 8 && file >= 0 && file < 8;
+}
+
+constexpr uint64_t stepAttacks(int sq, const int offsets[][2], int offsetCount) {
+    uint64_t attacks = 0;
+    for (int i = 0; i < offsetCount; i++) {
+        int rank = sq / 8 + offsets[i][0];
+        int file = sq % 8 + offsets[i][1];
+        if (onBoard(rank, file)) {
+            attacks |= 1lu << (rank * 8 + file);
+        }
+    }
+    return attacks;
+}
+
+constexpr uint64_t rayAttacks(int sq, int dRank, int dFile) {
+    uint64_t attacks = 0;
+    for (int rank = sq / 8 + dRank, file = sq % 8 + dFile; onBoard(rank, file); rank += dRank, file += dFile) {
+        attacks |= 1lu << (rank * 8 + file);
+    }
+    return attacks;
+}
+
+constexpr AttackTables generateAttackTables() {
+    AttackTables tables{};
+    const int knightOffsets[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    const int pawnOffsets[2][2][2] = {{{1, -1}, {1, 1}}, {{-1, -1}, {-1, 1}}};
+
+    for (int sq = 0; sq < 64; sq++) {
+        tables.knight[sq] = stepAttacks(sq, knightOffsets, 8);
+        tables.king[sq] = stepAttacks(sq, DIRECTIONS, 8);
+        tables.pawn[0][sq] = stepAttacks(sq, pawnOffsets[0], 2);
+        tables.pawn[1][sq] = stepAttacks(sq, pawnOffsets[1], 2);
+        for (int target = 0; target < 64; target++) {
+            tables.direction[sq][target] = NO_DIRECTION;
+        }
+
+        for (int d = 0; d < 8; d++) {
+            uint64_t line = (1lu << sq) | rayAttacks(sq, DIRECTIONS[d][0], DIRECTIONS[d][1]) |
+                            rayAttacks(sq, -DIRECTIONS[d][0], -DIRECTIONS[d][1]);
+            uint64_t between = 0;
+            int rank = sq / 8 + DIRECTIONS[d][0];
+            int file = sq % 8 + DIRECTIONS[d][1];
+            for (; onBoard(rank, file); rank += DIRECTIONS[d][0], file += DIRECTIONS[d][1]) {
+                int target = rank * 8 + file;
+                tables.line[sq][target] = line;
+                tables.between[sq][target] = between;
+                tables.direction[sq][target] = (int8_t)d;
+                between |= 1lu << target;
+            }
+        }
+    }
+    return tables;
+}
+
+// Built by the compiler, so there is nothing to initialize at startup.
+inline constexpr AttackTables ATTACKS = generateAttackTables();
+
+inline uint64_t rookAttacks(int sq, uint64_t occupied) {
+    const Magic &m = ROOK_MAGICS[sq];
+    return m.attacks[((occupied & m.mask) * m.magic) >> m.shift];
+}
+
+inline uint64_t bishopAttacks(int sq, uint64_t occupied) {
+    const Magic &m = BISHOP_MAGICS[sq];
+    return m.attacks[((occupied & m.mask) * m.magic) >> m.shift];
+}
+
+inline uint64_t queenAttacks(int sq, uint64_t occupied) {
+    return rookAttacks(sq, occupied) | bishopAttacks(sq, occupied);
+}
+
+#endif //CHESS_BITBOARD_H
@@ -0,0 +1,54 @@
+#ifndef CHESS_BOOK_H
+#define CHESS_BOOK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chess.h"
+
+// Polyglot hashes a position with 781 fixed random numbers: 768 for each piece on each square, then
+// four for castling rights, eight for the en passant file and one for white to move.
+const int POLYGLOT_KEY_COUNT = 781;
+const int POLYGLOT_CASTLING_KEYS = 768;
+const int POLYGLOT_TURN_KEY = 780;
+const size_t POLYGLOT_ENTRY_SIZE = 16;
+
+const int BOOK_SELECT_WEIGHTED = 0;
+const int BOOK_SELECT_BEST = 1;
+
+struct BookMove {
+    Move move;
+    uint16_t weight;
+};
+
+// The board keeps no en passant square, so the en passant keys are never added. Polyglot adds one only
+// when a pawn can actually capture en passant, so the keys differ from a book's just for those few
+// positions right after a double pawn push, and they go unfound.
+uint64_t polyglotKey(const Board &b);
+
+// A Polyglot book mapped read-only into memory. Entries are 16 big-endian bytes sorted by key, so a
+// probe is a binary search over the mapping and opening a book reads nothing up front.
+class OpeningBook {
+public:
+    OpeningBook() = default;
+    ~OpeningBook();
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const;
+
+    // The book's moves for b that are legal here, in book order. Castling moves are left out since
+    // the board doesn't support castling.
+    std::vector<BookMove> probe(Board &b) const;
+    // Picks among the moves with nonzero weight, at random in proportion to weight or the heaviest.
+    bool pickMove(Board &b, int selection, uint64_t &rngState, Move &move) const;
+
+private:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+};
+
+#endif //CHESS_BOOK_H
@@ -1,5 +1,34 @@
 
+#include <sstream>
+#include <thread>
+
 #include "chess.h"
+#include "evaluation.h"
+#include "bitboard.h"
+#include "tablebase.h"
+
+#ifdef CHESS_COUNT_ALLOCATIONS
+#include <new>
+#include <cstdlib>
+
+thread_local long heapAllocationCount = 0;
+
+void* operator new(std::size_t size) {
+    heapAllocationCount++;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
 
 uint8_t pieceTypeFromChar(char c) {
     switch (c) {
@@ -26,7 +55,36 @@ char pieceTypeToChar(uint8_t pt) {
     }
 }
 
-double getPieceScore(uint8_t pieceType) {
+struct ZobristKeys {
+    uint64_t pieces[2][7][64];
+    uint64_t blackToMove;
+};
+
+constexpr ZobristKeys generateZobristKeys() {
+    ZobristKeys keys{};
+    uint64_t state = 0x2545F4914F6CDD1Du;
+    for (auto &color : keys.pieces) {
+        for (auto &pieceType : color) {
+            for (uint64_t &key : pieceType) {
+                key = splitMix64(state);
+            }
+        }
+    }
+    keys.blackToMove = splitMix64(state);
+    return keys;
+}
+
+constexpr ZobristKeys ZOBRIST = generateZobristKeys();
+
+uint64_t zobristKey(bool isWhite, uint8_t pieceType, int rank, int file) {
+    return ZOBRIST.pieces[isWhite ? 0 : 1][pieceType][getBitIdx(rank, file)];
+}
+
+uint16_t encodeMove(const Move &m) {
+    return getBitIdx(m.startRank, m.startFile) | (getBitIdx(m.destRank, m.destFile) << 6u) | (m.promoteType << 12u);
+}
+
+int getPieceScore(uint8_t pieceType) {
     switch (pieceType) {
         case QUEEN: return QUEEN_WEIGHT;
         case ROOK: return ROOK_WEIGHT;
@@ -37,30 +95,23 @@ double getPieceScore(uint8_t pieceType) {
     }
 }
 
-double sumPieceList(const std::vector<PieceElement> &pieceList) {
-    double sum = 0;
+int sumPieceList(const PieceList &pieceList) {
+    int sum = 0;
     for (const PieceElement &pe : pieceList) {
         sum += getPieceScore(pe.pieceType);
     }
     return sum;
 }
 
-double getPieceScoreChange(const Move &m) {
-    if (m.captureType == 0 && m.promoteType == 0) {
-        return 0;
+int getPieceScoreChange(const Move &m) {
+    int change = 0;
+    if (m.captureType != EMPTY) {
+        change += getPieceScore(m.captureType);
     }
-
-    if (m.captureType == 0) {
-        if (m.promoteType == 0) {
-            return getPieceScore(m.captureType);
-        }
-    } else {
-        if (m.promoteType == 0) {
-            return getPieceScore(m.promoteType) - getPieceScore(PAWN_WEIGHT);
-        } else {
-            return getPieceScore(m.captureType) + getPieceScore(m.promoteType) - getPieceScore(PAWN_WEIGHT);
-        }
+    if (m.promoteType) {
+        change += getPieceScore(m.promoteType) - PAWN_WEIGHT;
     }
+    return change;
 }
 
 std::ostream& operator<<(std::ostream &os, const Board &b) {
@@ -73,484 +124,397 @@ std::ostream& operator<<(std::ostream &os, const Board &b) {
     return os;
 }
 
-bool spacesAreOnDiag(int sRank, int sFile, int tRank, int tFile) {
-    return std::abs(sRank - tRank) == std::abs(sFile - tFile);
-}
-
-bool spacesAreOnDirectPath(int sRank, int sFile, int tRank, int tFile) {
-    return sRank == tRank || sFile == tFile;
-}
+#ifndef CHESS_BITBOARD
 
-bool isDiagPathToSpace(const Board &b, int sRank, int sFile, int tRank, int tFile) {
-    int dist = std::abs(tRank-sRank);
-    int dRank = (tRank - sRank) / dist;
-    int dFile = (tFile - sFile) / dist;
-
-    int cRank = sRank;
-    int cFile = sFile;
-    while (true) {
-        cRank += dRank;
-        cFile += dFile;
-        if (cRank == tRank) {
-            return true;
-        }
-        if (b.boardMap[cRank][cFile] != EMPTY) {
+bool sliderCanMoveInDirection(uint8_t pieceType, int direction) {
+    switch (pieceType) {
+        case QUEEN:
+            return direction != NO_DIRECTION;
+        case ROOK:
+            return direction != NO_DIRECTION && direction < FIRST_DIAGONAL;
+        case BISHOP:
+            return direction >= FIRST_DIAGONAL;
+        default:
             return false;
-        }
     }
 }
 
-bool isDirectPathToSpace(const Board &b, int sRank, int sFile, int tRank, int tFile) {
-    int dRank = sRank == tRank ? 0 : (tRank - sRank) / std::abs(tRank-sRank);
-    int dFile = sFile == tFile ? 0 : (tFile - sFile) / std::abs(tFile-sFile);
-
-    int cRank = sRank;
-    int cFile = sFile;
-    while (true) {
-        cRank += dRank;
-        cFile += dFile;
-
-        if (cRank == tRank && cFile == tFile) {
-            return true;
-        }
-        if (b.boardMap[cRank][cFile] != EMPTY) {
+// Whether no piece other than transparent stands strictly between two aligned squares.
+bool isPathClear(const Board &b, int sSq, int tSq, uint8_t transparent) {
+    for (uint64_t between = ATTACKS.between[sSq][tSq]; between; popLsb(between)) {
+        uint8_t res = b.boardMap[lsbIdx(between)];
+        if (res != EMPTY && res != transparent) {
             return false;
         }
     }
+    return true;
 }
 
-bool isKnightAttacking(int sRank, int sFile, int tRank, int tFile) {
-    int rDist = std::abs(tRank-sRank);
-    int fDist = std::abs(tFile-sFile);
-    if (rDist == 1) {
-        return fDist == 2;
-    } else if (rDist == 2) {
-        return fDist == 1;
-    } else {
-        return false;
-    }
-}
-
-bool isPawnAttacking(bool isWhite, int sRank, int sFile, int tRank, int tFile) {
-    if (isWhite) {
-        return std::abs(tFile-sFile) == 1 && tRank-sRank == 1;
-    } else {
-        return std::abs(tFile-sFile) == 1 && tRank-sRank == -1;
-    }
-}
-
-bool isQueenAttacking(const Board &b, int sRank, int sFile, int tRank, int tFile) {
-    return (spacesAreOnDiag(sRank, sFile, tRank, tFile) && isDiagPathToSpace(b, sRank, sFile, tRank, tFile))
-           || (spacesAreOnDirectPath(sRank, sFile, tRank, tFile) && isDirectPathToSpace(b, sRank, sFile, tRank, tFile));
-}
-
-bool isAttacking(const Board &b, bool isWhite, const PieceElement &pe, int tRank, int tFile) {
+bool isAttacking(const Board &b, bool isWhite, const PieceElement &pe, int tSq) {
+    int sSq = getBitIdx(pe.rank, pe.file);
     switch (pe.pieceType) {
         case KING:
-            return std::abs(pe.rank - tRank) <= 1 && std::abs(pe.file - tFile) <= 1;
+            return getNthBit(ATTACKS.king[sSq], tSq);
         case QUEEN:
-            {
-                bool res = isQueenAttacking(b, pe.rank, pe.file, tRank, tFile);
-                return res;
-            }
         case ROOK:
-            return (spacesAreOnDirectPath(pe.rank, pe.file, tRank, tFile) && isDirectPathToSpace(b, pe.rank, pe.file, tRank, tFile));
         case BISHOP:
-            return (spacesAreOnDiag(pe.rank, pe.file, tRank, tFile) && isDiagPathToSpace(b, pe.rank, pe.file, tRank, tFile));
+            return sliderCanMoveInDirection(pe.pieceType, ATTACKS.direction[sSq][tSq]) &&
+                   isPathClear(b, sSq, tSq, EMPTY);
         case KNIGHT:
-            return isKnightAttacking(pe.rank, pe.file, tRank, tFile);
+            return getNthBit(ATTACKS.knight[sSq], tSq);
         case PAWN:
-            return isPawnAttacking(isWhite, pe.rank, pe.file, tRank, tFile);
+            return getNthBit(ATTACKS.pawn[colorIdx(isWhite)][sSq], tSq);
         default:
             return false;
     }
 }
 
-inline void tryAddMove(std::vector<Move> &moves, const Board &b, int sRank, int sFile, int tRank, int tFile, uint8_t pieceType) {
-    uint8_t boardRes = b.boardMap[tRank][tFile];
-    if (boardRes == INVALID) {
-        return;
+bool isSquareAttacked(const Board &b, int sq, bool byWhite) {
+    for (const PieceElement &pe : byWhite ? b.whitePieces : b.blackPieces) {
+        if (isAttacking(b, byWhite, pe, sq)) {
+            return true;
+        }
     }
+    return false;
+}
+
+template<Color C>
+inline void tryAddMove(MoveList &moves, const Board &b, int sRank, int sFile, int tRank, int tFile, uint8_t pieceType) {
+    uint8_t boardRes = b.boardMap[getBitIdx(tRank, tFile)];
     if (boardRes == EMPTY) {
-        moves.emplace_back(Move(pieceType, sRank, sFile, tRank, tFile, EMPTY, 0, false));
+        moves.push_back(Move(pieceType, sRank, sFile, tRank, tFile, EMPTY, 0, 0));
         return;
     }
 
-    if (b.whiteToMove) {
-        if (boardRes >= BLACK_LIST_START) {
-            uint8_t captureIdx = boardRes-BLACK_LIST_START;
-            moves.emplace_back(Move(pieceType, sRank, sFile, tRank, tFile, b.blackPieces[captureIdx].pieceType, captureIdx, false));
-        }
-    } else {
-        if (boardRes < BLACK_LIST_START) {
-            uint8_t captureIdx = boardRes-WHITE_LIST_START;
-            moves.emplace_back(Move(pieceType, sRank, sFile, tRank, tFile, b.whitePieces[captureIdx].pieceType, captureIdx, false));
-        }
+    if (pieceIsColor<opponent(C)>(boardRes)) {
+        uint8_t captureIdx = boardRes - listStart(opponent(C));
+        moves.push_back(Move(pieceType, sRank, sFile, tRank, tFile, b.pieces<opponent(C)>()[captureIdx].pieceType, captureIdx, 0));
     }
 }
 
-void addMovesForKing(std::vector<Move> &moves, Board &b, int sRank, int sFile) {
-    for (int dRank = -1; dRank <= 1; dRank++) {
-        for (int dFile = -1; dFile <= 1; dFile++) {
-            int cRank = sRank + dRank;
-            int cFile = sFile + dFile;
-            tryAddMove(moves, b, sRank, sFile, cRank, cFile, KING);
-        }
+template<Color C>
+void addMovesForTargets(MoveList &moves, const Board &b, int sRank, int sFile, uint8_t pieceType, uint64_t targets) {
+    for (; targets; popLsb(targets)) {
+        tryAddMove<C>(moves, b, sRank, sFile, sqRank(lsbIdx(targets)), sqFile(lsbIdx(targets)), pieceType);
     }
 }
 
-void getMovesForPath(std::vector<Move> &moves, const Board &b, int sRank, int sFile, uint8_t pieceType, int dRank, int dFile) {
+template<Color C>
+void addMovesForKing(MoveList &moves, const Board &b, int sRank, int sFile, uint64_t attacked) {
+    addMovesForTargets<C>(moves, b, sRank, sFile, KING, ATTACKS.king[getBitIdx(sRank, sFile)] & ~attacked);
+}
+
+template<Color C>
+void getMovesForPath(MoveList &moves, const Board &b, int sRank, int sFile, uint8_t pieceType, int dRank, int dFile) {
     int cRank = sRank + dRank;
     int cFile = sFile + dFile;
-    while(true) {
-        uint8_t boardRes = b.boardMap[cRank][cFile];
+    while(onBoard(cRank - PADDING, cFile - PADDING)) {
+        uint8_t boardRes = b.boardMap[getBitIdx(cRank, cFile)];
 
         if (boardRes == EMPTY) {
-            moves.emplace_back(Move(pieceType, sRank, sFile, cRank, cFile, EMPTY, 0, false));
+            moves.push_back(Move(pieceType, sRank, sFile, cRank, cFile, EMPTY, 0, 0));
             cRank += dRank;
             cFile += dFile;
             continue;
         }
 
-        if (boardRes == INVALID) {
-            return;
-        }
-
-        if (b.whiteToMove) {
-            if (boardRes >= BLACK_LIST_START) {
-                uint8_t captureIdx = boardRes-BLACK_LIST_START;
-                moves.emplace_back(Move(pieceType, sRank, sFile, cRank, cFile, b.blackPieces[captureIdx].pieceType, captureIdx,  false));
-            }
-        } else {
-            if (boardRes < BLACK_LIST_START) {
-                uint8_t captureIdx = boardRes-WHITE_LIST_START;
-                moves.emplace_back(Move(pieceType, sRank, sFile, cRank, cFile, b.whitePieces[boardRes-WHITE_LIST_START].pieceType, captureIdx, false));
-            }
+        if (pieceIsColor<opponent(C)>(boardRes)) {
+            uint8_t captureIdx = boardRes - listStart(opponent(C));
+            moves.push_back(Move(pieceType, sRank, sFile, cRank, cFile, b.pieces<opponent(C)>()[captureIdx].pieceType, captureIdx, 0));
         }
         return;
     }
 }
 
-void addMovesForDiagonals(std::vector<Move> &moves, const Board &b, int sRank, int sFile, uint8_t pieceType, bool isPinned) {
+// A pinned slider keeps to the line through its king, in both directions, if it moves along it at all.
+template<Color C>
+void addMovesForSlider(MoveList &moves, const Board &b, const PieceElement &pe, bool isPinned) {
     if (isPinned) {
-        const PieceElement &k = b.whiteToMove ? b.whitePieces[0] : b.blackPieces[0];
-        if (k.rank - sRank == 0 || k.file - sFile == 0) {
-            return;
+        const PieceElement &k = b.pieces<C>()[0];
+        int d = ATTACKS.direction[getBitIdx(k.rank, k.file)][getBitIdx(pe.rank, pe.file)];
+        if (sliderCanMoveInDirection(pe.pieceType, d)) {
+            getMovesForPath<C>(moves, b, pe.rank, pe.file, pe.pieceType, DIRECTIONS[d][0], DIRECTIONS[d][1]);
+            getMovesForPath<C>(moves, b, pe.rank, pe.file, pe.pieceType, -DIRECTIONS[d][0], -DIRECTIONS[d][1]);
         }
-        int dRank = (k.rank - sRank) / std::abs(k.rank - sRank);
-        int dFile = (k.file - sFile) / std::abs(k.file - sFile);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, dRank, dFile);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, -dRank, -dFile);
-
-    } else {
-        getMovesForPath(moves, b, sRank, sFile, pieceType, -1, -1);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, -1, 1);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, 1, -1);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, 1, 1);
+        return;
     }
-
-}
-
-void addMovesForDirectPath(std::vector<Move> &moves, const Board &b, int sRank, int sFile, uint8_t pieceType, bool isPinned) {
-    if (isPinned) {
-        const PieceElement &k = b.whiteToMove ? b.whitePieces[0] : b.blackPieces[0];
-        if (k.rank - sRank == 0) {
-            getMovesForPath(moves, b, sRank, sFile, pieceType, 0, -1);
-            getMovesForPath(moves, b, sRank, sFile, pieceType, 0, 1);
-        } else {
-            getMovesForPath(moves, b, sRank, sFile, pieceType, -1, 0);
-            getMovesForPath(moves, b, sRank, sFile, pieceType, 1, 0);
+    for (int d = 0; d < 8; d++) {
+        if (sliderCanMoveInDirection(pe.pieceType, d)) {
+            getMovesForPath<C>(moves, b, pe.rank, pe.file, pe.pieceType, DIRECTIONS[d][0], DIRECTIONS[d][1]);
         }
-    } else {
-        getMovesForPath(moves, b, sRank, sFile, pieceType, -1, 0);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, 1, 0);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, 0, -1);
-        getMovesForPath(moves, b, sRank, sFile, pieceType, 0, 1);
     }
 }
 
-void addMovesForQueen(std::vector<Move> &moves, const Board &b, int sRank, int sFile, bool isPinned) {
-    addMovesForDiagonals(moves, b, sRank, sFile, QUEEN, isPinned);
-    addMovesForDirectPath(moves, b, sRank, sFile, QUEEN, isPinned);
+template<Color C>
+void addMovesForKnight(MoveList &moves, const Board &b, int sRank, int sFile) {
+    addMovesForTargets<C>(moves, b, sRank, sFile, KNIGHT, ATTACKS.knight[getBitIdx(sRank, sFile)]);
 }
 
-void addMovesForKnight(std::vector<Move> &moves, const Board &b, int sRank, int sFile) {
-    for (int dRank = -2; dRank <= 2; dRank++) {
-        if (dRank == 0) {
-            continue;
-        }
-
-        int dFile = std::abs(dRank) == 2 ? 1 : 2;
-        tryAddMove(moves, b, sRank, sFile, sRank+dRank, sFile-dFile, KNIGHT);
-        tryAddMove(moves, b, sRank, sFile, sRank+dRank, sFile+dFile, KNIGHT);
+template<Color C>
+void addPawnMove(MoveList &moves, int sRank, int sFile, int tRank, int tFile, uint8_t captureType, uint8_t captureIdx) {
+    if (tRank == adjRank(C == WHITE ? 8 : 1)) {
+        moves.push_back(Move(PAWN, sRank, sFile, tRank, tFile, captureType, captureIdx, QUEEN));
+        moves.push_back(Move(PAWN, sRank, sFile, tRank, tFile, captureType, captureIdx, ROOK));
+        moves.push_back(Move(PAWN, sRank, sFile, tRank, tFile, captureType, captureIdx, BISHOP));
+        moves.push_back(Move(PAWN, sRank, sFile, tRank, tFile, captureType, captureIdx, KNIGHT));
+    } else {
+        moves.push_back(Move(PAWN, sRank, sFile, tRank, tFile, captureType, captureIdx, 0));
     }
 }
 
-void addMovesForPawnCapture(std::vector<Move> &moves, const Board &b, int sRank, int sFile, int dRank, int dFile) {
-    int tFile = sFile+dFile;
-    int tRank = sRank+dRank;
+template<Color C>
+void addMovesForPawnCapture(MoveList &moves, const Board &b, int sRank, int sFile, int dFile) {
+    int tFile = sFile + dFile;
+    int tRank = sRank + pawnDirection(C);
+    if (tFile < adjFile('a') || tFile > adjFile('h')) {
+        return;
+    }
 
-    uint8_t boardRes = b.boardMap[tRank][tFile];
-    if (boardRes == INVALID || boardRes == EMPTY) {
+    uint8_t boardRes = b.boardMap[getBitIdx(tRank, tFile)];
+    if (boardRes == EMPTY) {
         return;
     }
 
-    if (b.whiteToMove) {
-        if (boardRes >= BLACK_LIST_START) {
-            bool isPromote = tRank == adjRank(8);
-            uint8_t captureIdx = boardRes-BLACK_LIST_START;
-            moves.emplace_back(Move(PAWN, sRank, sFile, tRank, tFile, b.blackPieces[captureIdx].pieceType, captureIdx, isPromote));
-        }
-    } else {
-        if (boardRes < BLACK_LIST_START) {
-            bool isPromote = tRank == adjRank(1);
-            uint8_t captureIdx = boardRes-WHITE_LIST_START;
-            moves.emplace_back(Move(PAWN, sRank, sFile, tRank, tFile, b.whitePieces[captureIdx].pieceType, captureIdx, isPromote));
-        }
+    if (pieceIsColor<opponent(C)>(boardRes)) {
+        uint8_t captureIdx = boardRes - listStart(opponent(C));
+        addPawnMove<C>(moves, sRank, sFile, tRank, tFile, b.pieces<opponent(C)>()[captureIdx].pieceType, captureIdx);
     }
 }
 
-void addMovesForPawnAdvance(std::vector<Move> &moves, const Board &b, int sRank, int sFile, int dRank) {
-    uint8_t boardRes = b.boardMap[sRank + dRank][sFile];
+template<Color C>
+void addMovesForPawnAdvance(MoveList &moves, const Board &b, int sRank, int sFile) {
+    constexpr int dRank = pawnDirection(C);
+    uint8_t boardRes = b.boardMap[getBitIdx(sRank + dRank, sFile)];
     if (boardRes != EMPTY) {
         return;
     }
-    if (b.whiteToMove) {
-        if (sRank > adjRank(2)) {
-            bool isPromote = sRank + dRank == PADDING + 8 - 1;
-            if (isPromote) {
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, QUEEN));
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, BISHOP));
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, KNIGHT));
-            } else {
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, false));
-            }
-        } else {
-            moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, false));
-            if (b.boardMap[sRank + (dRank * 2)][sFile] == EMPTY) {
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + (dRank * 2), sFile, EMPTY, 0, false));
-            }
-        }
+    addPawnMove<C>(moves, sRank, sFile, sRank + dRank, sFile, EMPTY, 0);
 
-    } else {
-        if (sRank < adjRank(7)) {
-            bool isPromote = sRank + dRank == PADDING + 8 - 1;
-            if (isPromote) {
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, QUEEN));
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, BISHOP));
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, KNIGHT));
-            } else {
-                moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, false));
-            }
-
-        } else {
-            moves.emplace_back(Move(PAWN, sRank, sFile, sRank + dRank, sFile, EMPTY, 0, false));
-            if (b.boardMap[sRank + (dRank * 2)][sFile] == EMPTY) {
-                moves.emplace_back(PAWN, sRank, sFile, sRank + (dRank * 2), sFile, EMPTY, 0, false);
-            }
-        }
+    if (sRank == adjRank(C == WHITE ? 2 : 7) && b.boardMap[getBitIdx(sRank + (dRank * 2), sFile)] == EMPTY) {
+        moves.push_back(Move(PAWN, sRank, sFile, sRank + (dRank * 2), sFile, EMPTY, 0, 0));
     }
 }
 
-void addMovesForPawn(std::vector<Move> &moves, const Board &b, int sRank, int sFile, bool isPinned) {
-    int dRank = b.whiteToMove ? 1 : -1;
-    addMovesForPawnAdvance(moves, b, sRank, sFile, dRank);
-    addMovesForPawnCapture(moves, b, sRank, sFile, dRank, -1);
-    addMovesForPawnCapture(moves, b, sRank, sFile, dRank, 1);
+template<Color C>
+void addMovesForPawn(MoveList &moves, const Board &b, int sRank, int sFile) {
+    addMovesForPawnAdvance<C>(moves, b, sRank, sFile);
+    addMovesForPawnCapture<C>(moves, b, sRank, sFile, -1);
+    addMovesForPawnCapture<C>(moves, b, sRank, sFile, 1);
 }
 
-void addMovesForPiece(std::vector<Move> &moves, Board &b, const PieceElement &pe, bool isPinned) {
+template<Color C>
+void addMovesForPiece(MoveList &moves, const Board &b, const PieceElement &pe, bool isPinned) {
     switch (pe.pieceType) {
-        case KING:
-            addMovesForKing(moves, b, pe.rank, pe.file);
-            break;
         case QUEEN:
-            addMovesForQueen(moves, b, pe.rank, pe.file, isPinned);
-            break;
         case ROOK:
-            addMovesForDirectPath(moves, b, pe.rank, pe.file, ROOK, isPinned);
-            break;
         case BISHOP:
-            addMovesForDiagonals(moves, b, pe.rank, pe.file, BISHOP, isPinned);
+            addMovesForSlider<C>(moves, b, pe, isPinned);
             break;
         case KNIGHT:
-            addMovesForKnight(moves, b, pe.rank, pe.file);
+            addMovesForKnight<C>(moves, b, pe.rank, pe.file);
             break;
         case PAWN:
-            addMovesForPawn(moves, b, pe.rank, pe.file, isPinned);
+            addMovesForPawn<C>(moves, b, pe.rank, pe.file);
             break;
         default:
             break;
     }
 }
 
-bool pawnCanAttack(int pRank, int pFile, int tRank, int tFile, bool isWhite) {
-    if (isWhite) {
-        return tRank-pRank == 1 && std::abs(tFile-pFile) == 1;
-    } else {
-        return tRank-pRank == -1 && std::abs(tFile-pFile) == 1;
-    }
+bool inCheck(const Board &b, bool isWhite) {
+    const PieceElement &king(isWhite ? b.whitePieces[0] : b.blackPieces[0]);
+    return isSquareAttacked(b, getBitIdx(king.rank, king.file), !isWhite);
 }
 
-bool directionHasCheck(const Board &b, int sRank, int sFile, int dRank, int dFile, bool kingIsWhite) {
-    int cRank = sRank;
-    int cFile = sFile;
-    while (true) {
-        cRank += dRank;
-        cFile += dFile;
-
-        uint8_t res = b.boardMap[cRank][cFile];
-        if (res == EMPTY) {
+// Every move returned is legal. In double check only the king moves; otherwise other pieces must
+// land on the check mask, and a pinned piece must stay on the line through its king.
+template<Color C>
+MoveList getMoves(const Board &b, const BoardContext &bc) {
+    MoveList moves;
+    const PieceElement &k = b.pieces<C>()[0];
+    int kingSq = getBitIdx(k.rank, k.file);
+    for (const PieceElement &pe : b.pieces<C>()) {
+        int pinIdx = getBitIdx(pe.rank, pe.file);
+        bool isPinned = getNthBit(bc.pinned, pinIdx);
+        if (pe.pieceType == KING) {
+            addMovesForKing<C>(moves, b, pe.rank, pe.file, bc.attacked);
             continue;
-        } else if (res == INVALID) {
-            return false;
-        } else {
-            bool pieceIsWhite = res < BLACK_LIST_START;
-            if (pieceIsWhite == kingIsWhite) {
-                return false;
-            } else {
-                uint8_t pieceType = pieceIsWhite ?
-                                    b.whitePieces[res-WHITE_LIST_START].pieceType :
-                                    b.blackPieces[res-BLACK_LIST_START].pieceType;
-                if (pieceType == KNIGHT) {
-                    return false;
-                } else if (pieceType == PAWN) {
-                    return pawnCanAttack(cRank, cFile, sRank, sFile, pieceIsWhite);
-                } else {
-                    return true;
+        } else if (!bc.checkMask || (isPinned && pe.pieceType == KNIGHT)) {
+            continue;
+        }
+
+        int first = moves.size();
+        addMovesForPiece<C>(moves, b, pe, isPinned);
+        // Pinned sliders only generate along the pin already, but pawns and check evasions are
+        // filtered afterwards.
+        if (bc.checkers || (isPinned && pe.pieceType == PAWN)) {
+            int kept = first;
+            for (int i = first; i < moves.size(); i++) {
+                const Move &m = moves[i];
+                if (getNthBit(bc.checkMask, getBitIdx(m.destRank, m.destFile)) &&
+                        (!isPinned || getNthBit(ATTACKS.line[kingSq][pinIdx], getBitIdx(m.destRank, m.destFile)))) {
+                    moves[kept++] = m;
                 }
             }
+            moves.resize(kept);
         }
     }
+    return moves;
 }
 
-bool checkForPieceType(const Board &b, uint8_t targetPieceType, int rank, int file, bool targetColorIsWhite) {
-    uint8_t res = b.boardMap[rank][file];
-    if (res == EMPTY || res == INVALID) {
-        return false;
-    } else {
-        bool pieceIsWhite = res < BLACK_LIST_START;
-        if (pieceIsWhite != targetColorIsWhite) {
-            return false;
-        }
-
-        uint8_t pieceType = pieceIsWhite ?
-                            b.whitePieces[res-WHITE_LIST_START].pieceType :
-                            b.blackPieces[res-BLACK_LIST_START].pieceType;
-
-        return pieceType == targetPieceType;
-    }
+MoveList getMoves(Board &b, const BoardContext &bc) {
+    return b.whiteToMove ? getMoves<WHITE>(b, bc) : getMoves<BLACK>(b, bc);
 }
 
-bool knightCanAttackPosition(const Board &b, int rank, int file, bool targetColorIsWhite) {
-    for (int dRank = -2; dRank <= 2; dRank++) {
-        if (dRank == 0) {
-            continue;
-        }
+#endif
 
-        int dFile = std::abs(dRank) == 2 ? 1 : 2;
-        if (checkForPieceType(b, KNIGHT, rank+dRank, file-dFile, targetColorIsWhite) ||
-                checkForPieceType(b, KNIGHT, rank+dRank, file+dFile, targetColorIsWhite)) {
-            return true;
-        }
-    }
-    return false;
+bool comparePieceElement(const PieceElement &p1, const PieceElement &p2) {
+    return p1.pieceType < p2.pieceType;
 }
 
-bool inCheck(const Board &b, bool isWhite) {
-    const PieceElement &king(isWhite ? b.whitePieces[0] : b.blackPieces[0]);
-
-    return
-            directionHasCheck(b, king.rank, king.file, 1, 1, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, 1, 0, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, 1, -1, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, 0, 1, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, 0, -1, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, -1, 1, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, -1, 0, isWhite) ||
-            directionHasCheck(b, king.rank, king.file, -1, -1, isWhite) ||
-            knightCanAttackPosition(b, king.rank, king.file, !isWhite);
-}
-
-std::vector<Move> getMoves(Board &b, const BoardContext &bc) {
-    std::vector<Move> moves;
-    for (PieceElement pe : b.whiteToMove ? b.whitePieces : b.blackPieces) {
-        int pinIdx = getBitIdx(pe.rank, pe.file);
-        if (pe.pieceType == KING) {
-            std::vector<Move> kingMoves;
-            addMovesForKing(kingMoves, b, pe.rank, pe.file);
-            for (Move m : kingMoves) {
-                b.doMove(m);
-                if (!inCheck(b, !b.whiteToMove)) {
-                    moves.push_back(m);
-                }
-                b.undoMove(m);
-            }
-        } else if (getNthBit(bc.absolutePinned, pinIdx)) {
-            continue;
-        } else {
-            addMovesForPiece(moves, b, pe, getNthBit(bc.pinned, pinIdx));
-        }
+// The last piece of the list takes the place of the removed one, so the list only ever holds pieces
+// on the board. The king is always first and never removed.
+template<Color C>
+void Board::removePiece(uint8_t listIdx) {
+    PieceList &list = pieces<C>();
+    uint8_t last = --list.count;
+    if (listIdx != last) {
+        list[listIdx] = list[last];
+        boardMap[getBitIdx(list[listIdx].rank, list[listIdx].file)] = listStart(C) + listIdx;
     }
-    return moves;
 }
 
-bool comparePieceElement(const PieceElement &p1, const PieceElement &p2) {
-    return p1.pieceType < p2.pieceType;
+// Exactly undoes removePiece(listIdx): the piece that took its place goes back to the end. Leaves the
+// board map of pe's own square to the caller.
+template<Color C>
+void Board::restorePiece(uint8_t listIdx, const PieceElement &pe) {
+    PieceList &list = pieces<C>();
+    uint8_t last = list.count++;
+    if (listIdx != last) {
+        list[last] = list[listIdx];
+        boardMap[getBitIdx(list[last].rank, list[last].file)] = listStart(C) + last;
+    }
+    list[listIdx] = pe;
 }
 
+template<Color C>
 void Board::doMove(const Move &m) {
-    uint8_t pieceIdx = boardMap[m.startRank][m.startFile];
-    boardMap[m.startRank][m.startFile] = EMPTY;
-    boardMap[m.destRank][m.destFile] = pieceIdx;
-    PieceElement &pe = whiteToMove ? whitePieces[pieceIdx-WHITE_LIST_START] : blackPieces[pieceIdx-BLACK_LIST_START];
+    constexpr Color them = opponent(C);
+    uint8_t pieceIdx = boardMap[getBitIdx(m.startRank, m.startFile)];
+    boardMap[getBitIdx(m.startRank, m.startFile)] = EMPTY;
+    boardMap[getBitIdx(m.destRank, m.destFile)] = pieceIdx;
+    PieceElement &pe = pieces<C>()[pieceIdx - listStart(C)];
+    int startSq = getBitIdx(m.startRank, m.startFile);
+    int destSq = getBitIdx(m.destRank, m.destFile);
+    hash ^= ZOBRIST.pieces[C][pe.pieceType][startSq];
+    mgScore -= PST.mg[C][pe.pieceType][startSq];
+    egScore -= PST.eg[C][pe.pieceType][startSq];
+#ifdef CHESS_BITBOARD
+    uint64_t startBit = 1lu << startSq;
+    uint64_t destBit = 1lu << destSq;
+    colorBitBoards[C] ^= startBit | destBit;
+    pieceBitBoards[pe.pieceType] ^= startBit;
+#endif
     pe.rank = m.destRank;
     pe.file = m.destFile;
     if (m.promoteType) {
-        pe.pieceType = QUEEN;
+        pe.pieceType = m.promoteType;
+        phase += PST.phase[m.promoteType];
     }
+    hash ^= ZOBRIST.pieces[C][pe.pieceType][destSq];
+    mgScore += PST.mg[C][pe.pieceType][destSq];
+    egScore += PST.eg[C][pe.pieceType][destSq];
+#ifdef CHESS_BITBOARD
+    pieceBitBoards[pe.pieceType] ^= destBit;
+#endif
 
     if (m.captureType != EMPTY) {
-        if (whiteToMove) {
-            blackPieces[m.captureIdx].pieceType = CAPTURED;
-        } else {
-            whitePieces[m.captureIdx].pieceType = CAPTURED;
-        }
+        removePiece<them>(m.captureIdx);
+        hash ^= ZOBRIST.pieces[them][m.captureType][destSq];
+        mgScore -= PST.mg[them][m.captureType][destSq];
+        egScore -= PST.eg[them][m.captureType][destSq];
+        phase -= PST.phase[m.captureType];
+#ifdef CHESS_BITBOARD
+        colorBitBoards[them] ^= destBit;
+        pieceBitBoards[m.captureType] ^= destBit;
+#endif
+    }
+    whiteToMove = C != WHITE;
+    hash ^= ZOBRIST.blackToMove;
+    if (activeNetwork && accumulator) {
+        updateAccumulators(*this, m, C == WHITE, false);
     }
-    whiteToMove = !whiteToMove;
 }
 
+template<Color C>
 void Board::undoMove(const Move &m) {
-    whiteToMove = !whiteToMove;
-
-    uint8_t pieceIdx = boardMap[m.destRank][m.destFile];
-    boardMap[m.startRank][m.startFile] = pieceIdx;
-    PieceElement &pe = whiteToMove ? whitePieces[pieceIdx-WHITE_LIST_START] : blackPieces[pieceIdx-BLACK_LIST_START];
+    constexpr Color them = opponent(C);
+    whiteToMove = C == WHITE;
+    hash ^= ZOBRIST.blackToMove;
+
+    uint8_t pieceIdx = boardMap[getBitIdx(m.destRank, m.destFile)];
+    boardMap[getBitIdx(m.startRank, m.startFile)] = pieceIdx;
+    PieceElement &pe = pieces<C>()[pieceIdx - listStart(C)];
+    int startSq = getBitIdx(m.startRank, m.startFile);
+    int destSq = getBitIdx(m.destRank, m.destFile);
+    hash ^= ZOBRIST.pieces[C][pe.pieceType][destSq];
+    mgScore -= PST.mg[C][pe.pieceType][destSq];
+    egScore -= PST.eg[C][pe.pieceType][destSq];
+#ifdef CHESS_BITBOARD
+    uint64_t startBit = 1lu << startSq;
+    uint64_t destBit = 1lu << destSq;
+    colorBitBoards[C] ^= startBit | destBit;
+    pieceBitBoards[pe.pieceType] ^= destBit;
+#endif
     pe.rank = m.startRank;
     pe.file = m.startFile;
     if (m.promoteType) {
         pe.pieceType = PAWN;
+        phase -= PST.phase[m.promoteType];
+    }
+    hash ^= ZOBRIST.pieces[C][pe.pieceType][startSq];
+    mgScore += PST.mg[C][pe.pieceType][startSq];
+    egScore += PST.eg[C][pe.pieceType][startSq];
+#ifdef CHESS_BITBOARD
+    pieceBitBoards[pe.pieceType] ^= startBit;
+#endif
+
+    uint8_t boardMapValue = EMPTY;
+    if (m.captureType != EMPTY) {
+        restorePiece<them>(m.captureIdx, PieceElement(m.captureType, m.destRank, m.destFile));
+        boardMapValue = listStart(them) + m.captureIdx;
+        hash ^= ZOBRIST.pieces[them][m.captureType][destSq];
+        mgScore += PST.mg[them][m.captureType][destSq];
+        egScore += PST.eg[them][m.captureType][destSq];
+        phase += PST.phase[m.captureType];
+#ifdef CHESS_BITBOARD
+        colorBitBoards[them] ^= destBit;
+        pieceBitBoards[m.captureType] ^= destBit;
+#endif
+    }
+    boardMap[getBitIdx(m.destRank, m.destFile)] = boardMapValue;
+    if (activeNetwork && accumulator) {
+        updateAccumulators(*this, m, C == WHITE, true);
     }
+}
 
-    uint8_t boardMapValue;
-    if (m.captureType == EMPTY) {
-        boardMapValue = EMPTY;
-    } else {
-        if (whiteToMove) {
-            blackPieces[m.captureIdx].pieceType = m.captureType;
-            boardMapValue = BLACK_LIST_START + m.captureIdx;
+void Board::doMove(const Move &m) {
+    whiteToMove ? doMove<WHITE>(m) : doMove<BLACK>(m);
+}
 
-        } else {
-            whitePieces[m.captureIdx].pieceType = m.captureType;
-            boardMapValue = WHITE_LIST_START + m.captureIdx;
-        }
-    }
-    boardMap[m.destRank][m.destFile] = boardMapValue;
+// The move being undone was made by the side that is not to move now.
+void Board::undoMove(const Move &m) {
+    whiteToMove ? undoMove<BLACK>(m) : undoMove<WHITE>(m);
+}
+
+void Board::doNullMove() {
+    whiteToMove = !whiteToMove;
+    hash ^= ZOBRIST.blackToMove;
 }
 
 char Board::getCharForBoardMapValue(int rank, int file) const {
-    uint8_t res = boardMap[rank][file];
-    if (res == EMPTY || res == INVALID) {
+    uint8_t res = boardMap[getBitIdx(rank, file)];
+    if (res == EMPTY) {
         return pieceTypeToChar(res);
 
     } else if (res >= BLACK_LIST_START) {
@@ -565,10 +529,10 @@ char Board::getCharForBoardMapValue(int rank, int file) const {
 }
 
 Move::Move(uint8_t pieceType, uint8_t startRank, uint8_t startFile, uint8_t destRank, uint8_t destFile,
-           uint8_t captureType, uint8_t captureIdx, bool isPromote) : pieceType(pieceType), startRank(startRank),
-                                                                      startFile(startFile), destRank(destRank),
-                                                                      destFile(destFile), captureType(captureType),
-                                                                      captureIdx(captureIdx), promoteType(isPromote) {}
+           uint8_t captureType, uint8_t captureIdx, uint8_t promoteType) : pieceType(pieceType), startRank(startRank),
+                                                                            startFile(startFile), destRank(destRank),
+                                                                            destFile(destFile), captureType(captureType),
+                                                                            captureIdx(captureIdx), promoteType(promoteType) {}
 
 bool Move::operator==(const Move &rhs) const {
     return pieceType == rhs.pieceType &&
@@ -581,101 +545,659 @@ bool Move::operator==(const Move &rhs) const {
            promoteType == rhs.promoteType;
 }
 
-double getPiecesScore(const Board &b) {
-    return sumPieceList(b.whitePieces) - sumPieceList(b.blackPieces);
+bool isMateValue(int value) {
+    return std::abs(value) >= CHECKMATE_VALUE - MAX_PLY;
 }
 
-double getCheckmateScore(bool whiteCheckmate) {
-    return (whiteCheckmate ? 1 : -1) * std::numeric_limits<double>::max();
+// Full moves until mate for a mate value, counting the mating move itself.
+int movesToMate(int value) {
+    return (CHECKMATE_VALUE - std::abs(value) + 1) / 2;
 }
 
-bool isBetterEvaluationResult(const PositionEvaluation &e1, const PositionEvaluation &e2, bool whiteTurn) {
-    if (whiteTurn) {
-        if (e1.value > e2.value) {
-            return true;
-        } else if (e1.value == std::numeric_limits<double>::max()) {
-            if (e1.bestMovePath.size() < e2.bestMovePath.size()) {
-                return true;
-            }
-        } else if (e1.value == -std::numeric_limits<double>::max()) {
-            if (e1.bestMovePath.size() > e2.bestMovePath.size()) {
-                return true;
+// Mate values are stored relative to the node so they stay valid wherever the position is reached.
+int valueToTT(int value, int ply) {
+    if (isMateValue(value)) {
+        return value > 0 ? value + ply : value - ply;
+    }
+    return value;
+}
+
+int valueFromTT(int value, int ply) {
+    if (isMateValue(value)) {
+        return value > 0 ? value - ply : value + ply;
+    }
+    return value;
+}
+
+bool isQuietMove(const Move &m) {
+    return m.captureType == EMPTY && !m.promoteType;
+}
+
+int getMvvLvaValue(uint8_t pieceType) {
+    switch (pieceType) {
+        case KING: return 6;
+        case QUEEN: return 5;
+        case ROOK: return 4;
+        case BISHOP: return 3;
+        case KNIGHT: return 2;
+        case PAWN: return 1;
+        default: return 0;
+    }
+}
+
+int scoreMove(const Move &m, const Board &b, const SearchState &ss, int ply, uint16_t ttMove) {
+    uint16_t encoded = encodeMove(m);
+    if (encoded == ttMove) {
+        return TT_MOVE_ORDER_SCORE;
+    }
+    if (!isQuietMove(m)) {
+        // Most valuable victim first, least valuable attacker breaks ties.
+        int victim = m.captureType == EMPTY ? 0 : getMvvLvaValue(m.captureType);
+        int promotion = m.promoteType ? getMvvLvaValue(m.promoteType) : 0;
+        return CAPTURE_ORDER_SCORE + (victim + promotion) * 8 - getMvvLvaValue(m.pieceType);
+    }
+    if (encoded == ss.killers[ply][0]) {
+        return KILLER_ORDER_SCORE;
+    }
+    if (encoded == ss.killers[ply][1]) {
+        return KILLER_ORDER_SCORE - 1;
+    }
+    return ss.history[colorIdx(b.whiteToMove)][getBitIdx(m.startRank, m.startFile)][getBitIdx(m.destRank, m.destFile)];
+}
+
+// Orders moves by: principal variation move, transposition table move, captures by MVV-LVA, killer
+// moves, then quiet moves by history. Returns true if the principal variation move was found.
+bool orderMoves(MoveList &moves, const Board &b, const SearchState &ss, int ply, uint16_t ttMove, const Move *pvMove) {
+    bool foundPvMove = false;
+    int scores[MAX_MOVES];
+    for (int i = 0; i < moves.size(); i++) {
+        if (pvMove != nullptr && moves[i] == *pvMove) {
+            foundPvMove = true;
+            scores[i] = PV_MOVE_ORDER_SCORE;
+        } else {
+            scores[i] = scoreMove(moves[i], b, ss, ply, ttMove);
+        }
+    }
+
+    // Stable insertion sort; move lists are short and mostly generated in a sensible order already.
+    for (int i = 1; i < moves.size(); i++) {
+        Move m = moves[i];
+        int score = scores[i];
+        int j = i - 1;
+        for (; j >= 0 && scores[j] < score; j--) {
+            moves[j + 1] = moves[j];
+            scores[j + 1] = scores[j];
+        }
+        moves[j + 1] = m;
+        scores[j + 1] = score;
+    }
+    return foundPvMove;
+}
+
+void updateQuietMoveHistory(const Move &m, const Board &b, SearchState &ss, int ply, int depth) {
+    uint16_t encoded = encodeMove(m);
+    if (ss.killers[ply][0] != encoded) {
+        ss.killers[ply][1] = ss.killers[ply][0];
+        ss.killers[ply][0] = encoded;
+    }
+
+    int &entry = ss.history[colorIdx(b.whiteToMove)][getBitIdx(m.startRank, m.startFile)][getBitIdx(m.destRank, m.destFile)];
+    entry += depth * depth;
+    if (entry >= HISTORY_MAX) {
+        for (auto &color : ss.history) {
+            for (auto &from : color) {
+                for (int &value : from) {
+                    value /= 2;
+                }
             }
         }
-    } else {
-        if (e1.value < e2.value) {
+    }
+}
+
+bool searchStopped(const SearchState &ss) {
+    return ss.stop != nullptr && ss.stop->load(std::memory_order_relaxed);
+}
+
+// Returns true while a ponder search is still waiting for ponderhit. Once it arrives the time budget
+// starts from now, or from the start of the search when the pondered time counts.
+bool stillPondering(SearchState &ss) {
+    if (!ss.pondering) {
+        return false;
+    }
+    if (ss.control->pondering.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    ss.pondering = false;
+    if (!ss.ponderTimeCounts) {
+        ss.clockStart = std::chrono::steady_clock::now();
+    }
+    if (ss.budgetMillis) {
+        ss.deadline = ss.clockStart + std::chrono::milliseconds(ss.budgetMillis);
+    }
+    return false;
+}
+
+// Only the main thread polls the clock and node budget, every 1024 nodes; helpers just watch the
+// shared stop flag.
+void checkSearchLimits(SearchState &ss) {
+    long nodes = ss.stats.methodCalls + ss.stats.quiescenceNodes;
+    if ((nodes & 1023) != 0 || stillPondering(ss)) {
+        return;
+    }
+    if ((ss.nodeLimit && nodes >= ss.nodeLimit) || std::chrono::steady_clock::now() >= ss.deadline) {
+        ss.stop->store(true, std::memory_order_relaxed);
+    }
+}
+
+// The board to make the next move on. With copy-make that is a copy of b in ss.boards[ply + 1],
+// carrying a copy of b's accumulator, and b itself is left untouched; otherwise it is b, and the move
+// has to be taken back with unmakeMove.
+Board& childBoard(Board &b, int ply, SearchState &ss) {
+    if (!ss.copyMake) {
+        return b;
+    }
+    Board &child = ss.boards[ply + 1];
+    child = b;
+    if (b.accumulator) {
+        ss.accumulators[ply + 1] = *b.accumulator;
+        child.accumulator = &ss.accumulators[ply + 1];
+    }
+    return child;
+}
+
+// Returns the board to search the reply to m on.
+Board& makeMove(Board &b, const Move &m, int ply, SearchState &ss) {
+    Board &child = childBoard(b, ply, ss);
+    child.doMove(m);
+    return child;
+}
+
+void unmakeMove(Board &b, const Move &m, const SearchState &ss) {
+    if (!ss.copyMake) {
+        b.undoMove(m);
+    }
+}
+
+Board& makeNullMove(Board &b, int ply, SearchState &ss) {
+    Board &child = childBoard(b, ply, ss);
+    child.doNullMove();
+    return child;
+}
+
+void unmakeNullMove(Board &b, const SearchState &ss) {
+    if (!ss.copyMake) {
+        b.doNullMove();
+    }
+}
+
+// With only pawns left, passing can be better than any move (zugzwang), so a null move proves nothing.
+bool hasNonPawnMaterial(const Board &b) {
+    for (const PieceElement &pe : b.whiteToMove ? b.whitePieces : b.blackPieces) {
+        if (pe.pieceType != KING && pe.pieceType != PAWN) {
             return true;
-        } else if (e1.value == -std::numeric_limits<double>::max()) {
-            if (e1.bestMovePath.size() < e2.bestMovePath.size()) {
-                return true;
-            }
-        } else if (e1.value == std::numeric_limits<double>::max()) {
-            if (e1.bestMovePath.size() > e2.bestMovePath.size()) {
-                return true;
-            }
         }
     }
     return false;
 }
 
-PositionEvaluation evaluateHelper(Board &b, int depth, double pieceScore, Statistics &stats) {
-    stats.methodCalls++;
+// Quiet moves late in the ordering are searched this many plies shallower, more so the later they
+// come and the deeper the search, and less so for killers and moves with a good history.
+int lateMoveReduction(int depth, int moveIdx, int orderScore) {
+    int reduction = 1;
+    if (moveIdx >= LMR_LATE_MOVE_INDEX) {
+        reduction++;
+    }
+    if (depth >= 2 * LMR_MIN_DEPTH) {
+        reduction++;
+    }
+    if (orderScore >= LMR_GOOD_HISTORY) {
+        reduction--;
+    }
+    return std::max(0, std::min(reduction, depth - 2));
+}
+
+// Searches only captures and promotions until the position is quiet. The side to move may stand pat
+// on the static score, and captures that cannot raise the score to alpha even with DELTA_MARGIN to
+// spare are skipped. In check neither applies: every evasion is searched, quiet ones included.
+int quiescence(Board &b, int ply, int alpha, int beta, SearchState &ss) {
+    if (searchStopped(ss)) {
+        return 0;
+    }
+    ss.stats.quiescenceNodes++;
+    if (ss.checkLimits) {
+        checkSearchLimits(ss);
+    }
+    if (ply >= MAX_PLY - 1) {
+        return evaluate(b);
+    }
+
+    BoardContext bc(b);
+    bool evading = bc.checkers;
+    int standPat = -INFINITE_VALUE;
+    if (!evading) {
+        standPat = evaluate(b);
+        if (standPat >= beta) {
+            return standPat;
+        }
+        if (standPat > alpha) {
+            alpha = standPat;
+        }
+    }
+
+    MoveList moves = getMoves(b, bc);
+    if (moves.empty()) {
+        return evading ? -(CHECKMATE_VALUE - ply) : 0;
+    }
+    if (!evading) {
+        moves.resize(std::remove_if(moves.begin(), moves.end(), isQuietMove) - moves.begin());
+    }
+    orderMoves(moves, b, ss, ply, 0, nullptr);
+
+    int best = standPat;
+    for (const Move &m : moves) {
+        if (!evading && standPat + getPieceScoreChange(m) + DELTA_MARGIN <= alpha) {
+            continue;
+        }
+        Board &next = makeMove(b, m, ply, ss);
+        int value = -quiescence(next, ply + 1, -beta, -alpha, ss);
+        unmakeMove(b, m, ss);
+
+        if (value > best) {
+            best = value;
+        }
+        if (value > alpha) {
+            alpha = value;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+    return best;
+}
+
+// Negamax alpha-beta with principal variation search. Values are relative to the side to move and
+// mates are scored as CHECKMATE_VALUE - ply so shorter mates are preferred. Only the first move at
+// each node is searched with the full window, the rest get a zero window and are re-searched if
+// they turn out to be better. The best line found is left in ss.pvTable[ply].
+// Away from the principal variation and out of check, the search is selective: a position whose
+// static evaluation is well above beta near the leaves, or that still beats beta after passing the
+// turn with a reduced search, is cut off right away; near the leaves quiet moves can't lift a
+// hopeless static evaluation to alpha and are skipped; and late quiet moves are searched shallower
+// first. Moves that give check are never pruned or reduced.
+int evaluateHelper(Board &b, int depth, int ply, int alpha, int beta, SearchState &ss, bool allowNullMove = true) {
+    ss.pvLength[ply] = 0;
+    if (searchStopped(ss)) {
+        return 0;
+    }
+    ss.stats.methodCalls++;
+    if (ss.checkLimits) {
+        checkSearchLimits(ss);
+    }
+    // Tablebase results are exact, so the subtree below isn't searched.
+    if (ply > 0 && b.whitePieces.size() + b.blackPieces.size() <= tablebasePieces()) {
+        TablebaseResult tb;
+        if (probeTablebase(b, tb)) {
+            ss.stats.tbHits++;
+            return tablebaseValue(tb, ply);
+        }
+    }
     if (depth == 0) {
-        stats.leafNodesReached++;
-        return PositionEvaluation(pieceScore, std::vector<Move>());
+        ss.stats.leafNodesReached++;
+        return quiescence(b, ply, alpha, beta, ss);
+    }
+
+    bool isPvNode = beta - alpha > NULL_WINDOW;
+    uint16_t ttMove = 0;
+    TTEntry entry;
+    if (ss.tt.probe(b.hash, entry)) {
+        ss.stats.ttHits++;
+        ttMove = entry.move;
+        int ttValue = valueFromTT(entry.value, ply);
+        if (!isPvNode && ply > 0 && entry.depth >= depth &&
+                (entry.bound == BOUND_EXACT ||
+                (entry.bound == BOUND_LOWER && ttValue >= beta) ||
+                (entry.bound == BOUND_UPPER && ttValue <= alpha))) {
+            return ttValue;
+        }
     }
 
     BoardContext bc(b);
-    std::vector<Move> moves = getMoves(b, bc);
+    bool canPrune = !isPvNode && !bc.checkers && ply > 0;
+    int staticEval = canPrune && (ss.features.nullMove || ss.features.futility) ? evaluate(b) : 0;
+    if (canPrune && ss.features.futility && depth <= FUTILITY_MAX_DEPTH && !isMateValue(beta) &&
+            staticEval - FUTILITY_MARGIN * depth >= beta) {
+        ss.stats.reverseFutilityCutoffs++;
+        return staticEval;
+    }
+    if (canPrune && ss.features.nullMove && allowNullMove && depth >= NULL_MOVE_MIN_DEPTH && staticEval >= beta &&
+            hasNonPawnMaterial(b)) {
+        int reduction = NULL_MOVE_REDUCTION + depth / 6;
+        Board &next = makeNullMove(b, ply, ss);
+        int value = -evaluateHelper(next, std::max(0, depth - 1 - reduction), ply + 1, -beta, -beta + NULL_WINDOW, ss, false);
+        unmakeNullMove(b, ss);
+        if (searchStopped(ss)) {
+            return 0;
+        }
+        if (value >= beta) {
+            ss.stats.nullMoveCutoffs++;
+            return isMateValue(value) ? beta : value;
+        }
+    }
+    bool futile = canPrune && ss.features.futility && depth <= FUTILITY_MAX_DEPTH && !isMateValue(alpha) &&
+            staticEval + FUTILITY_MARGIN * depth <= alpha;
+    bool mayReduce = ss.features.lateMoveReductions && !bc.checkers && depth >= LMR_MIN_DEPTH;
+
+    MoveList moves = getMoves(b, bc);
     if (moves.empty()) {
-        if (inCheck(b, b.whiteToMove)) {
-            stats.checkMateEvaluations++;
-            return PositionEvaluation(getCheckmateScore(!b.whiteToMove), std::vector<Move>());
+        if (bc.checkers) {
+            ss.stats.checkMateEvaluations++;
+            return -(CHECKMATE_VALUE - ply);
         } else {
-            stats.staleMateEvaluations++;
-            return PositionEvaluation(0, std::vector<Move>());
+            ss.stats.staleMateEvaluations++;
+            return 0;
         }
     }
 
-    Move bestMove;
-    PositionEvaluation best(0, std::vector<Move>());
-    bool haveBest = false;
+    if (ply == 0 && !ss.rootExcluded.empty()) {
+        moves.resize(std::remove_if(moves.begin(), moves.end(), [&](const Move &m) {
+            return std::find(ss.rootExcluded.begin(), ss.rootExcluded.end(), m) != ss.rootExcluded.end();
+        }) - moves.begin());
+    }
 
-    for (const Move &m : moves) {
-        b.doMove(m);
-        double newPieceScore = pieceScore + (b.whiteToMove ? 1 : -1) * getPieceScoreChange(m);
-        PositionEvaluation res = evaluateHelper(b, depth - 1, newPieceScore, stats);
-        b.undoMove(m);
+    // While on the previous iteration's principal variation, its move goes first.
+    const Move *pvMove = nullptr;
+    if (ss.followPv && ply < ss.pvLineLength) {
+        pvMove = &ss.pvLine[ply];
+    }
+    bool onPv = orderMoves(moves, b, ss, ply, ttMove, pvMove);
+    ss.followPv = false;
+
+    if (ply == 0 && ss.rootMoveOffset) {
+        std::rotate(moves.begin(), moves.begin() + ss.rootMoveOffset % moves.size(), moves.end());
+    }
+
+    int originalAlpha = alpha;
+    Move bestMove = moves[0];
+    int best = -INFINITE_VALUE;
+
+    for (int i = 0; i < moves.size(); i++) {
+        const Move &m = moves[i];
+        bool quiet = i > 0 && isQuietMove(m);
+        bool reducible = quiet && mayReduce && i >= LMR_FIRST_MOVE_INDEX;
+        int orderScore = reducible ? scoreMove(m, b, ss, ply, ttMove) : 0;
+        ss.followPv = onPv && i == 0;
+        Board &next = makeMove(b, m, ply, ss);
+        int reduction = 0;
+        if ((futile || reducible) && quiet && !inCheck(next, next.whiteToMove)) {
+            if (futile) {
+                unmakeMove(b, m, ss);
+                ss.stats.futilityPrunes++;
+                continue;
+            }
+            reduction = lateMoveReduction(depth, i, orderScore);
+        }
+        int value;
+        if (i == 0) {
+            value = -evaluateHelper(next, depth - 1, ply + 1, -beta, -alpha, ss);
+        } else {
+            value = -evaluateHelper(next, depth - 1 - reduction, ply + 1, -alpha - NULL_WINDOW, -alpha, ss);
+            if (reduction) {
+                ss.stats.reductions++;
+                if (value > alpha) {
+                    ss.stats.reductionResearches++;
+                    value = -evaluateHelper(next, depth - 1, ply + 1, -alpha - NULL_WINDOW, -alpha, ss);
+                }
+            }
+            if (value > alpha && value < beta) {
+                ss.stats.researches++;
+                value = -evaluateHelper(next, depth - 1, ply + 1, -beta, -alpha, ss);
+            }
+        }
+        unmakeMove(b, m, ss);
 
-        if (!haveBest || isBetterEvaluationResult(res, best, b.whiteToMove)) {
-            best = res;
+        if (value > best) {
+            best = value;
             bestMove = m;
-            haveBest = true;
+            ss.pvTable[ply][0] = m;
+            std::copy(ss.pvTable[ply + 1], ss.pvTable[ply + 1] + ss.pvLength[ply + 1], ss.pvTable[ply] + 1);
+            ss.pvLength[ply] = ss.pvLength[ply + 1] + 1;
+        }
+        if (value > alpha) {
+            alpha = value;
+        }
+        if (alpha >= beta) {
+            ss.stats.betaCutoffs++;
+            if (i == 0) {
+                ss.stats.firstMoveCutoffs++;
+            }
+            if (isQuietMove(m)) {
+                updateQuietMoveHistory(m, b, ss, ply, depth);
+            }
+            break;
         }
     }
 
-    best.bestMovePath.insert(best.bestMovePath.begin(), bestMove);
+    // With root moves left out, the value isn't the position's.
+    if (searchStopped(ss) || (ply == 0 && !ss.rootExcluded.empty())) {
+        return best;
+    }
+
+    uint8_t bound = best >= beta ? BOUND_LOWER : (best > originalAlpha ? BOUND_EXACT : BOUND_UPPER);
+    ss.stats.ttStores++;
+    if (ss.tt.store(b.hash, depth, bound, valueToTT(best, ply), encodeMove(bestMove))) {
+        ss.stats.ttOverwrites++;
+    }
 
     return best;
 }
 
 Evaluation evaluateBoard(Board &b, int maxDepth) {
+    static TranspositionTable tt(DEFAULT_HASH_MB);
+    return evaluateBoard(b, maxDepth, tt);
+}
+
+Evaluation evaluateBoard(Board &b, int maxDepth, TranspositionTable &tt, int threads) {
+    SearchLimits limits;
+    limits.depth = maxDepth;
+    limits.threads = threads;
+    return evaluateBoard(b, limits, tt);
+}
+
+long allocateTimeMillis(const SearchLimits &limits) {
+    if (limits.moveTimeMillis) {
+        return limits.moveTimeMillis;
+    }
+    if (!limits.timeLeftMillis) {
+        return 0;
+    }
+    int movesToGo = limits.movesToGo ? limits.movesToGo : DEFAULT_MOVES_TO_GO;
+    long budget = limits.timeLeftMillis / movesToGo + limits.incrementMillis * 3 / 4;
+    return std::max(1L, std::min(budget, limits.timeLeftMillis - MOVE_OVERHEAD_MILLIS));
+}
+
+// Searches one ply deeper each iteration, starting from the previous principal variation, and returns
+// the result of the last iteration that completed. An iteration cut short by the stop flag is thrown
+// away unless nothing has completed yet. The search keeps its own accumulator for b, and gives the
+// board back with the one it came with.
+// With ss.multiPv above 1, each iteration searches the root once per line, leaving out the moves of
+// the lines already found, each time starting from that line's previous principal variation.
+PositionEvaluation iterativeDeepening(Board &b, int startDepth, int maxDepth, long softLimitMillis, SearchState &ss) {
+    auto start = std::chrono::steady_clock::now();
+    ss.clockStart = start;
+    Accumulator *callerAccumulator = b.accumulator;
+    attachAccumulator(b, activeNetwork ? &ss.accumulators[0] : nullptr);
+
+    BoardContext bc(b);
+    int lineCount = std::max(1, std::min(ss.multiPv, getMoves(b, bc).size()));
+    ss.lines.clear();
+    for (int depth = startDepth; depth <= maxDepth; depth++) {
+        std::vector<PositionEvaluation> depthLines;
+        ss.rootExcluded.clear();
+        for (int line = 0; line < lineCount; line++) {
+            if (line < (int)ss.lines.size()) {
+                const std::vector<Move> &pv = ss.lines[line].bestMovePath;
+                std::copy(pv.begin(), pv.end(), ss.pvLine);
+                ss.pvLineLength = pv.size();
+            } else if (line > 0) {
+                ss.pvLineLength = 0;
+            }
+            ss.followPv = true;
+#ifdef CHESS_COUNT_ALLOCATIONS
+            long allocationsBefore = heapAllocationCount;
+#endif
+            int value = evaluateHelper(b, depth, 0, -INFINITE_VALUE, INFINITE_VALUE, ss);
+#ifdef CHESS_COUNT_ALLOCATIONS
+            ss.stats.heapAllocations += heapAllocationCount - allocationsBefore;
+#endif
+            if (searchStopped(ss) && !ss.lines.empty()) {
+                break;
+            }
+            depthLines.emplace_back(value, std::vector<Move>(ss.pvTable[0], ss.pvTable[0] + ss.pvLength[0]));
+            if (searchStopped(ss) || ss.pvLength[0] == 0) {
+                break;
+            }
+            ss.rootExcluded.push_back(ss.pvTable[0][0]);
+        }
+        ss.rootExcluded.clear();
+        if (searchStopped(ss) && !ss.lines.empty()) {
+            break;
+        }
+        std::stable_sort(depthLines.begin(), depthLines.end(), [](const PositionEvaluation &a, const PositionEvaluation &b) {
+            return a.value > b.value;
+        });
+        ss.lines = depthLines;
+        ss.stats.depthReached = depth;
+        auto now = std::chrono::steady_clock::now();
+        if (ss.control && ss.control->onIteration) {
+            long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+            for (int line = 0; line < (int)ss.lines.size(); line++) {
+                ss.control->onIteration(SearchInfo{depth, ss.lines[line].value, ss.stats.methodCalls + ss.stats.quiescenceNodes,
+                                                   elapsed, ss.lines[line].bestMovePath, ss.stats.tbHits, line + 1});
+            }
+        }
+        if (searchStopped(ss)) {
+            break;
+        }
+
+        // The next iteration usually costs several times the last one, so don't start it past half the budget.
+        long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - ss.clockStart).count();
+        if (softLimitMillis && !stillPondering(ss) && elapsed >= softLimitMillis / 2) {
+            break;
+        }
+    }
+    b.accumulator = callerAccumulator;
+    return ss.lines.empty() ? PositionEvaluation(0, {}) : ss.lines[0];
+}
+
+void helperSearch(Board b, int startDepth, int maxDepth, SearchState &ss) {
+    iterativeDeepening(b, startDepth, maxDepth, 0, ss);
+}
+
+// Lazy SMP: helper threads run their own iterative deepening on board copies, every other one a ply
+// ahead and each starting from a different root move, and feed the shared transposition table.
+// Only the main thread's result is reported; the helpers are stopped as soon as it finishes.
+// With a control the search also stops when its stop flag is set from another thread.
+Evaluation evaluateBoard(Board &b, const SearchLimits &limits, TranspositionTable &tt, SearchControl *control) {
     Evaluation e;
-    auto start = std::chrono::system_clock::now();
-    double pieceScore = sumPieceList(b.whitePieces) - sumPieceList(b.blackPieces);
+    auto start = std::chrono::steady_clock::now();
+    int maxDepth = std::max(1, std::min(limits.depth, MAX_PLY - 1));
+    long budgetMillis = allocateTimeMillis(limits);
+
+    std::atomic<bool> localStop(false);
+    std::atomic<bool> &stop = control ? control->stop : localStop;
+    SearchState ss(tt);
+    ss.stop = &stop;
+    ss.control = control;
+    ss.pondering = control && limits.ponder;
+    ss.ponderTimeCounts = limits.ponderTimeCounts;
+    ss.nodeLimit = limits.nodes;
+    ss.budgetMillis = budgetMillis;
+    if (budgetMillis && !ss.pondering) {
+        ss.deadline = start + std::chrono::milliseconds(budgetMillis);
+    }
+    ss.checkLimits = true;
+    ss.copyMake = limits.copyMake;
+    ss.features = limits.features;
+    ss.multiPv = limits.multiPv;
+
+    // A position covered by the tablebases is played from them without a search, unless several
+    // lines are wanted.
+    Move tablebaseMove;
+    TablebaseResult tablebaseResult;
+    bool fromTablebase = limits.multiPv <= 1 && probeTablebaseRoot(b, tablebaseMove, tablebaseResult);
+
+    std::vector<SearchState> helperStates(fromTablebase ? 0 : std::max(limits.threads - 1, 0), SearchState(tt));
+    std::vector<std::thread> helpers;
+    for (int i = 0; i < (int)helperStates.size(); i++) {
+        helperStates[i].stop = &stop;
+        helperStates[i].copyMake = limits.copyMake;
+        helperStates[i].features = limits.features;
+        helperStates[i].rootMoveOffset = i + 1;
+        helpers.emplace_back(helperSearch, b, 1 + (i + 1) % 2, maxDepth, std::ref(helperStates[i]));
+    }
+
+    if (fromTablebase) {
+        ss.stats.tbHits++;
+        ss.stats.depthReached = 1;
+        e.pos = PositionEvaluation(tablebaseValue(tablebaseResult, 0), {tablebaseMove});
+        e.lines = {e.pos};
+        if (control && control->onIteration) {
+            control->onIteration(SearchInfo{1, e.pos.value, 0, 0, e.pos.bestMovePath, ss.stats.tbHits});
+        }
+    } else {
+        e.pos = iterativeDeepening(b, 1, maxDepth, budgetMillis, ss);
+        e.lines = ss.lines;
+    }
 
-    e.pos = evaluateHelper(b, maxDepth, pieceScore, e.stats);
-    auto end = std::chrono::system_clock::now();
+    stop = true;
+    for (std::thread &helper : helpers) {
+        helper.join();
+    }
+
+    if (!b.whiteToMove) {
+        e.pos.value = -e.pos.value;
+        for (PositionEvaluation &line : e.lines) {
+            line.value = -line.value;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    e.stats = ss.stats;
+    for (const SearchState &hs : helperStates) {
+        e.stats += hs.stats;
+    }
+    e.stats.threads = std::max(limits.threads, 1);
     e.stats.evaluationDurationMillis = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     return e;
 }
 
+Statistics& Statistics::operator+=(const Statistics &rhs) {
+    leafNodesReached += rhs.leafNodesReached;
+    quiescenceNodes += rhs.quiescenceNodes;
+    methodCalls += rhs.methodCalls;
+    checkMateEvaluations += rhs.checkMateEvaluations;
+    staleMateEvaluations += rhs.staleMateEvaluations;
+    betaCutoffs += rhs.betaCutoffs;
+    firstMoveCutoffs += rhs.firstMoveCutoffs;
+    researches += rhs.researches;
+    nullMoveCutoffs += rhs.nullMoveCutoffs;
+    reverseFutilityCutoffs += rhs.reverseFutilityCutoffs;
+    futilityPrunes += rhs.futilityPrunes;
+    reductions += rhs.reductions;
+    reductionResearches += rhs.reductionResearches;
+    tbHits += rhs.tbHits;
+    heapAllocations += rhs.heapAllocations;
+    ttHits += rhs.ttHits;
+    ttStores += rhs.ttStores;
+    ttOverwrites += rhs.ttOverwrites;
+    return *this;
+}
+
 
 std::ostream &operator<<(std::ostream &os, const PieceElement &pe) {
     return os << '(' << pieceTypeToChar(pe.pieceType) << ',' << (int)pe.rank << ',' << (int)pe.file << ')';
 }
 
-std::ostream &operator<<(std::ostream &os, const std::vector<PieceElement> &pList) {
+std::ostream &operator<<(std::ostream &os, const PieceList &pList) {
     os << '{';
     auto it = pList.begin();
     if (it != pList.end()) {
@@ -706,18 +1228,34 @@ std::ostream &operator<<(std::ostream &os, const Move &m) {
     if (m.captureType != EMPTY) {
         os << 'x';
     }
-    return os << unAdjFile(m.startFile)
+    os << unAdjFile(m.startFile)
     << unAdjRank(m.startRank)
     << unAdjFile(m.destFile)
     << unAdjRank(m.destRank);
+    if (m.promoteType) {
+        os << pieceTypeToChar(m.promoteType);
+    }
+    return os;
 }
 
 std::ostream &operator<<(std::ostream &os, const Statistics &s) {
-    os << "executionTimeMillis: " << s.evaluationDurationMillis << " functionCalls: " << s.methodCalls << " leafNodes: " << s.leafNodesReached;
+    os << "executionTimeMillis: " << s.evaluationDurationMillis << " functionCalls: " << s.methodCalls << " leafNodes: " << s.leafNodesReached
+       << " quiescenceNodes: " << s.quiescenceNodes
+       << " betaCutoffs: " << s.betaCutoffs
+       << " firstMoveCutoffRate: " << (s.betaCutoffs ? (double)s.firstMoveCutoffs / s.betaCutoffs : 0)
+       << " researches: " << s.researches
+       << " nullMoveCutoffs: " << s.nullMoveCutoffs << " reverseFutilityCutoffs: " << s.reverseFutilityCutoffs
+       << " futilityPrunes: " << s.futilityPrunes << " reductions: " << s.reductions
+       << " reductionResearches: " << s.reductionResearches << " tbHits: " << s.tbHits
+       << " ttHits: " << s.ttHits << " ttStores: " << s.ttStores << " ttOverwrites: " << s.ttOverwrites
+#ifdef CHESS_COUNT_ALLOCATIONS
+       << " heapAllocations: " << s.heapAllocations
+#endif
+       << " depth: " << s.depthReached << " threads: " << s.threads << " nps: " << (s.evaluationDurationMillis > 0 ? (s.methodCalls + s.quiescenceNodes) * 1000 / s.evaluationDurationMillis : 0);
     return os;
 }
 
-PositionEvaluation::PositionEvaluation(double value, const std::vector<Move> &bestMovePath) : value(value),
+PositionEvaluation::PositionEvaluation(int value, const std::vector<Move> &bestMovePath) : value(value),
                                                                                           bestMovePath(bestMovePath) {}
 bool PieceElement::operator==(const PieceElement &rhs) const {
     return pieceType == rhs.pieceType &&
@@ -725,42 +1263,25 @@ bool PieceElement::operator==(const PieceElement &rhs) const {
            file == rhs.file;
 }
 
-bool Board::operator==(const Board &rhs) const {
-    bool boardMapsAreEqual = true;
-    for (int r = 0; r < 12; r++) {
-        bool shouldBreak = false;
-        for (int f = 0; f < 12; f++) {
-            if (boardMap[r][f] != rhs.boardMap[r][f]) {
-                boardMapsAreEqual = false;
-                shouldBreak = true;
-                break;
-            }
-        }
-        if (shouldBreak) {
-            break;
-        }
-    }
+bool PieceList::operator==(const PieceList &rhs) const {
+    return std::equal(begin(), end(), rhs.begin(), rhs.end());
+}
 
-    return boardMapsAreEqual &&
+bool Board::operator==(const Board &rhs) const {
+    return std::equal(std::begin(boardMap), std::end(boardMap), std::begin(rhs.boardMap)) &&
         whitePieces == rhs.whitePieces &&
         blackPieces == rhs.blackPieces &&
         whiteToMove == rhs.whiteToMove;
 }
 
 std::string evaluationValueToString(const PositionEvaluation &res) {
-    if (std::fabs(res.value) == std::numeric_limits<double>::max()) {
-        return std::string("#") + std::to_string((res.bestMovePath.size()+1)/2);
-    } else {
-        return std::to_string(res.value);
-    }
-}
-
-Board::Board(const Board &rhs) : whitePieces(rhs.whitePieces), blackPieces(rhs.blackPieces), whiteToMove(rhs.whiteToMove) {
-    for (int r = 0; r < 12; r++) {
-        for (int f = 0; f < 12; f++) {
-            boardMap[r][f] = rhs.boardMap[r][f];
-        }
+    if (isMateValue(res.value)) {
+        return std::string(res.value > 0 ? "#" : "#-") + std::to_string(movesToMate(res.value));
     }
+    std::string sign = res.value < 0 ? "-" : "";
+    int pawns = std::abs(res.value) / 100;
+    int centipawns = std::abs(res.value) % 100;
+    return sign + std::to_string(pawns) + (centipawns < 10 ? ".0" : ".") + std::to_string(centipawns);
 }
 
 std::string Board::toFen() const {
@@ -768,7 +1289,7 @@ std::string Board::toFen() const {
     for (int r = adjRank(8); r >= adjRank(1); r--) {
         int curEmpty = 0;
         for (int f = adjFile('a'); f <= adjFile('h'); f++) {
-            uint8_t res = boardMap[r][f];
+            uint8_t res = boardMap[getBitIdx(r, f)];
             if (res == EMPTY) {
                 curEmpty++;
             } else {
@@ -826,7 +1347,7 @@ Move moveFromString(const std::string &s, const Board &b) {
         sRank = adjRank(s[3]-'0');
         dFile = adjFile(s[4]);
         dRank = adjRank(s[5]-'0');
-        captureIdx = b.boardMap[dRank][dFile] - (b.whiteToMove ? BLACK_LIST_START : WHITE_LIST_START);
+        captureIdx = b.boardMap[getBitIdx(dRank, dFile)] - (b.whiteToMove ? BLACK_LIST_START : WHITE_LIST_START);
         captureType = (b.whiteToMove ? b.blackPieces[captureIdx] : b.whitePieces[captureIdx]).pieceType;
     } else {
         sFile = adjFile(s[1]);
@@ -836,8 +1357,12 @@ Move moveFromString(const std::string &s, const Board &b) {
         captureIdx = 0;
         captureType = EMPTY;
     }
-    bool isPromote = pieceType == PAWN && dRank == (b.whiteToMove ? adjRank(8) : adjRank(1));
-    return {pieceType, sRank, sFile, dRank, dFile, captureType, captureIdx, isPromote};
+    uint8_t promoteType = 0;
+    if (pieceType == PAWN && dRank == (b.whiteToMove ? adjRank(8) : adjRank(1))) {
+        size_t promoteCharIdx = s[1] == 'x' ? 6 : 5;
+        promoteType = s.size() > promoteCharIdx ? pieceTypeFromChar(s[promoteCharIdx]) : QUEEN;
+    }
+    return {pieceType, sRank, sFile, dRank, dFile, captureType, captureIdx, promoteType};
 }
 
 void printBitBoard(uint64_t bitBoard) {
@@ -851,16 +1376,48 @@ void printBitBoard(uint64_t bitBoard) {
 }
 
 
-Board::Board(std::string fen) {
-    {
-        for (int r = 0; r < 12; r++) {
-            for (int f = 0; f < 12 ; f++) {
-                if (r < 2 || r >= 10 || f < 2 || f >= 10) {
-                    boardMap[r][f] = INVALID;
-                }
+// Checks what Board(fen) relies on: eight ranks of eight squares, one king and at most MAX_PIECES
+// pieces per side, and w or b to move. The fields after the side to move aren't read.
+bool isValidFen(const std::string &fen) {
+    std::istringstream fields(fen);
+    std::string placement;
+    std::string side;
+    if (!(fields >> placement >> side) || (side != "w" && side != "b")) {
+        return false;
+    }
+    int ranks = 1;
+    int files = 0;
+    int pieces[2] = {0, 0};
+    int kings[2] = {0, 0};
+    for (char c : placement) {
+        if (c == '/') {
+            if (files != 8) {
+                return false;
             }
+            ranks++;
+            files = 0;
+            continue;
+        }
+        if (c >= '1' && c <= '8') {
+            files += c - '0';
+        } else if (pieceTypeFromChar(std::tolower(c)) != INVALID) {
+            int color = std::islower(c) ? 1 : 0;
+            pieces[color]++;
+            kings[color] += std::tolower(c) == 'k';
+            files++;
+        } else {
+            return false;
+        }
+        if (files > 8) {
+            return false;
         }
+    }
+    return ranks == 8 && files == 8 && kings[0] == 1 && kings[1] == 1 &&
+           pieces[0] <= MAX_PIECES && pieces[1] <= MAX_PIECES;
+}
 
+Board::Board(std::string fen) {
+    {
         int rank = PADDING+8-1;
         int file = PADDING;
 
@@ -895,32 +1452,81 @@ Board::Board(std::string fen) {
                 int endFile = file+value;
 
                 for (; file < endFile; file++) {
-                    boardMap[rank][file] = EMPTY;
+                    boardMap[getBitIdx(rank, file)] = EMPTY;
                 }
                 continue;
             }
 
+            // A side can't hold more than MAX_PIECES; isValidFen rejects such a FEN, and here the
+            // extra pieces are dropped rather than written past the list.
             uint8_t pieceType = pieceTypeFromChar(std::tolower(*it));
-            if (std::islower(*it)) {
-//                boardMap[rank][file] = BLACK_LIST_START + blackPieces.size();
-                blackPieces.emplace_back(pieceType, rank, file);
-            } else {
-//                boardMap[rank][file] = WHITE_LIST_START + whitePieces.size();
-                whitePieces.emplace_back(pieceType, rank, file);
+            PieceList &side = std::islower(*it) ? blackPieces : whitePieces;
+            if (side.size() < MAX_PIECES) {
+                side.push_back(PieceElement(pieceType, rank, file));
             }
             file++;
         }
 
-        std::sort(whitePieces.begin(), whitePieces.end(), comparePieceElement);
-        std::sort(blackPieces.begin(), blackPieces.end(), comparePieceElement);
+        placePieces();
+    }
+}
 
-        for (int i = 0; i < blackPieces.size(); i++) {
-            PieceElement pe = blackPieces[i];
-            boardMap[pe.rank][pe.file] = BLACK_LIST_START + i;
-        }
-        for (int i = 0; i < whitePieces.size(); i++) {
-            PieceElement pe = whitePieces[i];
-            boardMap[pe.rank][pe.file] = WHITE_LIST_START + i;
+Board::Board(const PieceList &white, const PieceList &black, bool whiteToMove)
+        : whitePieces(white), blackPieces(black), whiteToMove(whiteToMove) {
+    placePieces();
+}
+
+void Board::placePieces() {
+    std::sort(whitePieces.begin(), whitePieces.end(), comparePieceElement);
+    std::sort(blackPieces.begin(), blackPieces.end(), comparePieceElement);
+
+    std::fill(std::begin(boardMap), std::end(boardMap), EMPTY);
+    for (int i = 0; i < blackPieces.size(); i++) {
+        PieceElement pe = blackPieces[i];
+        boardMap[getBitIdx(pe.rank, pe.file)] = BLACK_LIST_START + i;
+    }
+    for (int i = 0; i < whitePieces.size(); i++) {
+        PieceElement pe = whitePieces[i];
+        boardMap[getBitIdx(pe.rank, pe.file)] = WHITE_LIST_START + i;
+    }
+    hash = computeHash();
+    computeEval();
+
+#ifdef CHESS_BITBOARD
+    std::fill(std::begin(pieceBitBoards), std::end(pieceBitBoards), 0);
+    std::fill(std::begin(colorBitBoards), std::end(colorBitBoards), 0);
+    for (const PieceElement &pe : whitePieces) {
+        setBitBoardBit(pieceBitBoards[pe.pieceType], pe.rank, pe.file);
+        setBitBoardBit(colorBitBoards[colorIdx(true)], pe.rank, pe.file);
+    }
+    for (const PieceElement &pe : blackPieces) {
+        setBitBoardBit(pieceBitBoards[pe.pieceType], pe.rank, pe.file);
+        setBitBoardBit(colorBitBoards[colorIdx(false)], pe.rank, pe.file);
+    }
+#endif
+}
+
+uint64_t Board::computeHash() const {
+    uint64_t res = whiteToMove ? 0 : ZOBRIST.blackToMove;
+    for (const PieceElement &pe : whitePieces) {
+        res ^= zobristKey(true, pe.pieceType, pe.rank, pe.file);
+    }
+    for (const PieceElement &pe : blackPieces) {
+        res ^= zobristKey(false, pe.pieceType, pe.rank, pe.file);
+    }
+    return res;
+}
+
+void Board::computeEval() {
+    mgScore = 0;
+    egScore = 0;
+    phase = 0;
+    for (int color = 0; color < 2; color++) {
+        for (const PieceElement &pe : color == 0 ? whitePieces : blackPieces) {
+            int sq = getBitIdx(pe.rank, pe.file);
+            mgScore += PST.mg[color][pe.pieceType][sq];
+            egScore += PST.eg[color][pe.pieceType][sq];
+            phase += PST.phase[pe.pieceType];
         }
     }
 }
@@ -941,59 +1547,85 @@ void test() {
 //    std::cout << (m1 == m2);
 }
 
+#ifndef CHESS_BITBOARD
+
+// Looks at each enemy piece once. Knights and pawns next to the king give check, and a slider
+// aligned with the king gives check when nothing stands in between or pins a lone friendly piece.
+// Only the squares the king could step to are filled in to attacked, which costs less here than
+// walking the rays out of every enemy piece. The king is left out of the blockers for them so it
+// can't step back along the ray it is checked on.
 BoardContext::BoardContext(const Board &b) {
     const PieceElement &k(b.whiteToMove ? b.whitePieces[0] : b.blackPieces[0]);
-    updatePinnedPiecesForDirection(b, k, 1, 1);
-    updatePinnedPiecesForDirection(b, k, 1, 0);
-    updatePinnedPiecesForDirection(b, k, 1, -1);
-    updatePinnedPiecesForDirection(b, k, 0, 1);
-    updatePinnedPiecesForDirection(b, k, 0, -1);
-    updatePinnedPiecesForDirection(b, k, -1, 1);
-    updatePinnedPiecesForDirection(b, k, -1, 0);
-    updatePinnedPiecesForDirection(b, k, -1, 1);
-}
-
-void BoardContext::updatePinnedPiecesForDirection(const Board &b, const PieceElement &k, int dRank, int dFile) {
-    int cRank = k.rank;
-    int cFile = k.file;
-
-    bool isDiag = !(dRank == 0 || dFile == 0);
-
-    const PieceElement* pinnedPiecePtr = nullptr;
-    while (true) {
-        cRank += dRank;
-        cFile += dFile;
+    int kingSq = getBitIdx(k.rank, k.file);
+    uint8_t kingRes = b.whiteToMove ? WHITE_LIST_START : BLACK_LIST_START;
+    uint64_t kingTargets = 0;
+    for (uint64_t squares = ATTACKS.king[kingSq]; squares; popLsb(squares)) {
+        uint8_t res = b.boardMap[lsbIdx(squares)];
+        if (res == EMPTY || (res < BLACK_LIST_START) != b.whiteToMove) {
+            setNthBit(kingTargets, lsbIdx(squares));
+        }
+    }
 
-        uint8_t res = b.boardMap[cRank][cFile];
-        if (res == EMPTY) {
-            continue;
-        } else if (res == INVALID) {
-            return;
-        } else {
-            bool pieceIsWhite = res < BLACK_LIST_START;
-            if (pieceIsWhite == b.whiteToMove) {
-                if (pinnedPiecePtr != nullptr) {
-                    return;
+    uint64_t evasions = 0;
+    for (const PieceElement &pe : b.whiteToMove ? b.blackPieces : b.whitePieces) {
+        int sq = getBitIdx(pe.rank, pe.file);
+        uint64_t stepAttacks;
+        switch (pe.pieceType) {
+            case KING:
+                stepAttacks = ATTACKS.king[sq];
+                break;
+            case KNIGHT:
+                stepAttacks = ATTACKS.knight[sq];
+                break;
+            case PAWN:
+                stepAttacks = ATTACKS.pawn[colorIdx(!b.whiteToMove)][sq];
+                break;
+            case QUEEN:
+            case ROOK:
+            case BISHOP:
+                for (uint64_t targets = kingTargets & ~attacked; targets; popLsb(targets)) {
+                    if (sliderCanMoveInDirection(pe.pieceType, ATTACKS.direction[sq][lsbIdx(targets)]) &&
+                            isPathClear(b, sq, lsbIdx(targets), kingRes)) {
+                        setNthBit(attacked, lsbIdx(targets));
+                    }
                 }
-                pinnedPiecePtr = &b.pieceElementForBoardValue(res);
+                updateForSlider(b, pe, kingSq, evasions);
+                continue;
+            default:
+                continue;
+        }
+        attacked |= stepAttacks & kingTargets;
+        if (getNthBit(stepAttacks, kingSq)) {
+            setNthBit(checkers, sq);
+        }
+    }
+    if (checkers) {
+        checkMask = popCount(checkers) > 1 ? 0 : checkers | evasions;
+    }
+}
 
-            } else {
+void BoardContext::updateForSlider(const Board &b, const PieceElement &pe, int kingSq, uint64_t &evasions) {
+    int sq = getBitIdx(pe.rank, pe.file);
+    if (!sliderCanMoveInDirection(pe.pieceType, ATTACKS.direction[sq][kingSq])) {
+        return;
+    }
 
-                const PieceElement &pe = b.pieceElementForBoardValue(res);
-                if (pe.pieceType == QUEEN || (isDiag ? (pe.pieceType == BISHOP) : (pe.pieceType == ROOK))) {
-                    if (pinnedPiecePtr == nullptr) {
-                        return;
-                    }
-                    int pinIdx = getBitIdx(pinnedPiecePtr->rank, pinnedPiecePtr->file);
-                    if (pinnedPiecePtr->pieceType == QUEEN || (isDiag ? (pinnedPiecePtr->pieceType == BISHOP) : (pinnedPiecePtr->pieceType == ROOK))) {
-                        setNthBit(pinned, pinIdx);
-                    } else {
-                        setNthBit(absolutePinned, pinIdx);
-                    }
-                }
+    uint64_t between = ATTACKS.between[kingSq][sq];
+    int blockerSq = -1;
+    for (uint64_t squares = between; squares; popLsb(squares)) {
+        if (b.boardMap[lsbIdx(squares)] != EMPTY) {
+            if (blockerSq != -1) {
                 return;
             }
-
+            blockerSq = lsbIdx(squares);
         }
     }
+    if (blockerSq == -1) {
+        setNthBit(checkers, sq);
+        evasions |= between;
+    } else if ((b.boardMap[blockerSq] < BLACK_LIST_START) == b.whiteToMove) {
+        setNthBit(pinned, blockerSq);
+    }
 }
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef CHESS_CHESS_H
 #define CHESS_CHESS_H
 
+#include <cassert>
 #include <cmath>
 #include <string>
 #include <vector>
@@ -12,6 +13,12 @@
 #include <algorithm>
 #include <limits>
 #include <chrono>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+
+#include "transposition.h"
+#include "nnue.h"
 
 const uint8_t EMPTY = 16;
 const uint8_t KING = 1;
@@ -21,17 +28,45 @@ const uint8_t BISHOP = 4;
 const uint8_t KNIGHT = 5;
 const uint8_t PAWN = 6;
 const uint8_t INVALID = 0xFFu;
-const uint8_t CAPTURED = 0xFEu;
 
+const uint8_t MAX_PIECES = 16;
 const uint8_t WHITE_LIST_START = 0;
 const uint8_t BLACK_LIST_START = 17;
 const uint8_t PADDING = 2;
 
-const double QUEEN_WEIGHT = 10;
-const double ROOK_WEIGHT = 5;
-const double BISHOP_WEIGHT = 3.1;
-const double KNIGHT_WEIGHT = 3;
-const double PAWN_WEIGHT = 1;
+const std::string START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// Scores are in centipawns. A mate found n plies from the root scores CHECKMATE_VALUE - n.
+const int QUEEN_WEIGHT = 1000;
+const int ROOK_WEIGHT = 500;
+const int BISHOP_WEIGHT = 310;
+const int KNIGHT_WEIGHT = 300;
+const int PAWN_WEIGHT = 100;
+
+const int CHECKMATE_VALUE = 30000;
+const int INFINITE_VALUE = CHECKMATE_VALUE + 1;
+const int NULL_WINDOW = 1;
+const int DELTA_MARGIN = 2 * PAWN_WEIGHT;
+const int MAX_PLY = 128;
+
+const int NULL_MOVE_MIN_DEPTH = 3;
+const int NULL_MOVE_REDUCTION = 2;
+const int FUTILITY_MAX_DEPTH = 3;
+const int FUTILITY_MARGIN = 150;
+const int LMR_MIN_DEPTH = 3;
+const int LMR_FIRST_MOVE_INDEX = 3;
+const int LMR_LATE_MOVE_INDEX = 8;
+const int LMR_GOOD_HISTORY = 1024;
+
+const int DEFAULT_MOVES_TO_GO = 30;
+const long MOVE_OVERHEAD_MILLIS = 20;
+
+const int MAX_MOVES = 256;
+const int HISTORY_MAX = 1 << 20;
+const int PV_MOVE_ORDER_SCORE = 1 << 30;
+const int TT_MOVE_ORDER_SCORE = PV_MOVE_ORDER_SCORE - 1;
+const int CAPTURE_ORDER_SCORE = 1 << 28;
+const int KILLER_ORDER_SCORE = CAPTURE_ORDER_SCORE - 1000;
 
 #define adjRank(rank) ((int)(rank)+PADDING-1)
 #define adjFile(file) ((char)(file)-'a'+PADDING)
@@ -40,8 +75,41 @@ const double PAWN_WEIGHT = 1;
 #define unAdjFile(file) ((char)((int)(file)+'a'-PADDING))
 
 #define getBitIdx(rank, file) ((((rank)-PADDING)*8) + (file)-PADDING)
+#define sqRank(sq) ((sq) / 8 + PADDING)
+#define sqFile(sq) ((sq) % 8 + PADDING)
 #define setNthBit(bitmap, n) ((bitmap) |= (1lu << (n)))
-#define getNthBit(bitmap, n) (((bitmap) >> n) & 1lu)
+#define getNthBit(bitmap, n) (((bitmap) >> (n)) & 1lu)
+
+constexpr uint64_t splitMix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27u)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31u);
+}
+
+#define colorIdx(isWhite) ((isWhite) ? 0 : 1)
+
+// Side to move as a template parameter, so hot paths dispatch on it once per node instead of
+// testing whiteToMove throughout. The values match colorIdx.
+enum Color { WHITE, BLACK };
+
+constexpr Color opponent(Color c) {
+    return c == WHITE ? BLACK : WHITE;
+}
+
+constexpr uint8_t listStart(Color c) {
+    return c == WHITE ? WHITE_LIST_START : BLACK_LIST_START;
+}
+
+constexpr int pawnDirection(Color c) {
+    return c == WHITE ? 1 : -1;
+}
+
+// For a board map value holding a piece, not EMPTY.
+template<Color C>
+constexpr bool pieceIsColor(uint8_t boardRes) {
+    return C == WHITE ? boardRes < BLACK_LIST_START : boardRes >= BLACK_LIST_START;
+}
 
 #define setBitBoardBit(bitBoard, rank, file) (setNthBit(bitBoard, getBitIdx(rank, file)))
 #define getBitBoardBit(bitBoard, rank, file) (getNthBit(bitBoard, getBitIdx(rank, file)))
@@ -54,10 +122,30 @@ struct PieceElement {
     uint8_t rank;
     uint8_t file;
 
+    PieceElement() = default;
     PieceElement(uint8_t pieceType, uint8_t rank, uint8_t file) : pieceType(pieceType), rank(rank), file(file) {}
     bool operator==(const PieceElement &rhs) const;
 };
 
+// Fixed-capacity piece list kept inline in the Board, like MoveList, so copying a board is a memcpy.
+struct PieceList {
+    PieceElement pieces[MAX_PIECES];
+    uint8_t count = 0;
+
+    void push_back(const PieceElement &pe) {
+        assert(count < MAX_PIECES);
+        pieces[count++] = pe;
+    }
+    int size() const { return count; }
+    PieceElement* begin() { return pieces; }
+    PieceElement* end() { return pieces + count; }
+    const PieceElement* begin() const { return pieces; }
+    const PieceElement* end() const { return pieces + count; }
+    PieceElement& operator[](int i) { return pieces[i]; }
+    const PieceElement& operator[](int i) const { return pieces[i]; }
+    bool operator==(const PieceList &rhs) const;
+};
+
 bool comparePieceElement(const PieceElement &p1, const PieceElement &p2);
 
 struct Move {
@@ -73,15 +161,50 @@ struct Move {
     Move(){}
 
     Move(uint8_t pieceType, uint8_t startRank, uint8_t startFile, uint8_t destRank, uint8_t destFile,
-         uint8_t captureType, uint8_t captureIdx, bool isPromote);
+         uint8_t captureType, uint8_t captureIdx, uint8_t promoteType);
 
     bool operator==(const Move &rhs) const;
 };
 
+// Fixed-capacity move buffer kept on the stack so move generation and search never touch the heap.
+struct MoveList {
+    Move moves[MAX_MOVES];
+    int count = 0;
+
+    void push_back(const Move &m) { moves[count++] = m; }
+    void resize(int size) { count = size; }
+    void clear() { count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+    const Move* begin() const { return moves; }
+    const Move* end() const { return moves + count; }
+    Move& operator[](int i) { return moves[i]; }
+    const Move& operator[](int i) const { return moves[i]; }
+};
+
+// A flat, trivially copyable position of 192 bytes (264 with CHESS_BITBOARD), so search can copy it
+// instead of undoing moves and threads can clone it without touching the heap. The NNUE
+// accumulator is too large to copy per node and lives outside, see attachAccumulator in nnue.h.
 struct Board {
-    std::vector<PieceElement> whitePieces;
-    std::vector<PieceElement> blackPieces;
-    uint8_t boardMap[12][12];
+    uint64_t hash;
+    // First layer of the active network for each perspective, or nullptr when not kept up to date.
+    Accumulator *accumulator = nullptr;
+#ifdef CHESS_BITBOARD
+    uint64_t pieceBitBoards[7];
+    uint64_t colorBitBoards[2];
+#endif
+    // Incrementally updated evaluation terms from white's point of view, see evaluation.h.
+    int mgScore;
+    int egScore;
+    int phase;
+    // Only the pieces on the board, king first. A capture swap-removes, see removePiece.
+    PieceList whitePieces;
+    PieceList blackPieces;
+    // Index into whitePieces (from WHITE_LIST_START) or blackPieces (from BLACK_LIST_START), or
+    // EMPTY, for each square (a1 = 0).
+    uint8_t boardMap[64];
     bool whiteToMove;
 
 //    uint64_t attackedSpaces;
@@ -91,11 +214,22 @@ struct Board {
 //    int16_t halfMoveCount;
 //    uint16_t enPassant;
 
+    Board() = default;
     explicit Board (std::string fen);
-    Board(const Board &rhs);
+    // For positions built square by square, like the tablebase generator's. Needs each king.
+    Board(const PieceList &white, const PieceList &black, bool whiteToMove);
 
     void doMove(const Move &m);
     void undoMove(const Move &m);
+    template<Color C> void doMove(const Move &m);
+    template<Color C> void undoMove(const Move &m);
+    // Passes the turn, for null-move pruning. Undoing it is the same operation.
+    void doNullMove();
+
+    template<Color C> PieceList& pieces() { return C == WHITE ? whitePieces : blackPieces; }
+    template<Color C> const PieceList& pieces() const { return C == WHITE ? whitePieces : blackPieces; }
+    template<Color C> void removePiece(uint8_t listIdx);
+    template<Color C> void restorePiece(uint8_t listIdx, const PieceElement &pe);
 
     PieceElement& pieceElementForBoardValue(uint8_t boardRes);
     const PieceElement& pieceElementForBoardValue(uint8_t boardRes) const;
@@ -103,50 +237,195 @@ struct Board {
     bool operator==(const Board &rhs) const;
     char getCharForBoardMapValue(int rank, int file) const;
     std::string toFen() const;
+    uint64_t computeHash() const;
+    void computeEval();
+    // Sorts the piece lists king first and derives everything else from them.
+    void placePieces();
 };
 
+static_assert(std::is_trivially_copyable<Board>::value, "Board must stay copyable with memcpy");
+
+// Everything getMoves needs to generate only legal moves for the side to move, as squares (a1 = 0).
+// checkMask is where a non-king move has to land: every square when not in check, the checker and
+// the squares between it and the king in single check, none in double check. attacked is the
+// squares the opponent attacks with the king removed from the board; the mailbox backend only fills
+// in the ones next to the king.
 struct BoardContext {
     uint64_t pinned = 0;
-    uint64_t absolutePinned = 0;
+    uint64_t checkers = 0;
+    uint64_t checkMask = ~0lu;
+    uint64_t attacked = 0;
 
     explicit BoardContext(const Board &b);
-    void updatePinnedPiecesForDirection(const Board &b, const PieceElement &k, int dRank, int dFile);
+#ifndef CHESS_BITBOARD
+    void updateForSlider(const Board &b, const PieceElement &pe, int kingSq, uint64_t &evasions);
+#endif
 };
 
 struct Statistics {
     long leafNodesReached = 0;
+    long quiescenceNodes = 0;
     long methodCalls = 0;
     long checkMateEvaluations = 0;
     long staleMateEvaluations = 0;
+    long betaCutoffs = 0;
+    long firstMoveCutoffs = 0;
+    long researches = 0;
+    long nullMoveCutoffs = 0;
+    long reverseFutilityCutoffs = 0;
+    long futilityPrunes = 0;
+    long reductions = 0;
+    long reductionResearches = 0;
+    long tbHits = 0;
+    long ttHits = 0;
+    long ttStores = 0;
+    long ttOverwrites = 0;
     long evaluationDurationMillis = 0;
+    int depthReached = 0;
+    // Made inside the tree search, so 0 when nodes don't allocate. The result vectors built once per
+    // iteration, outside evaluateHelper, aren't counted.
+    long heapAllocations = 0;
+    int threads = 1;
+
+    Statistics& operator+=(const Statistics &rhs);
 };
 
 struct PositionEvaluation {
-    double value;
+    int value;
     std::vector<Move> bestMovePath;
 
     PositionEvaluation() = default;
-    PositionEvaluation(double value, const std::vector<Move> &bestMovePath);
+    PositionEvaluation(int value, const std::vector<Move> &bestMovePath);
+};
+
+// Selective search techniques, all on by default. Each can be switched off to measure what it gains
+// in time to depth and strength.
+struct SearchFeatures {
+    bool nullMove = true;
+    bool lateMoveReductions = true;
+    bool futility = true;
+};
+
+// A limit of 0 means unlimited. timeLeftMillis and incrementMillis are the clock of the side to move;
+// moveTimeMillis takes precedence over them when set.
+// A ponder search has no time limit until SearchControl::pondering is cleared (ponderhit); the
+// budget starts counting from then, or with ponderTimeCounts from the start of the search, for a
+// caller keeping its own clock that wants the pondered time to shorten the reply.
+// With copyMake each move is made on a copy of the board instead of being undone afterwards; the
+// search itself is the same either way. multiPv is how many root moves get their own value and line,
+// see Evaluation::lines.
+struct SearchLimits {
+    int depth = MAX_PLY - 1;
+    long moveTimeMillis = 0;
+    long timeLeftMillis = 0;
+    long incrementMillis = 0;
+    int movesToGo = 0;
+    long nodes = 0;
+    int threads = 1;
+    bool ponder = false;
+    bool ponderTimeCounts = false;
+    bool copyMake = false;
+    int multiPv = 1;
+    SearchFeatures features;
+};
+
+// Reported after each completed iteration, once per line in a multi-PV search, multiPv numbering
+// them from 1 best first. The value is relative to the side to move.
+struct SearchInfo {
+    int depth;
+    int value;
+    long nodes;
+    long elapsedMillis;
+    std::vector<Move> pv;
+    long tbHits;
+    int multiPv = 1;
+};
+
+// Lets another thread stop a running search or end its ponder phase, and receive progress reports.
+struct SearchControl {
+    std::atomic<bool> stop{false};
+    std::atomic<bool> pondering{false};
+    std::function<void(const SearchInfo&)> onIteration;
+};
+
+struct SearchState {
+    TranspositionTable &tt;
+    Statistics stats;
+    std::atomic<bool> *stop = nullptr;
+    int rootMoveOffset = 0;
+    SearchFeatures features;
+
+    SearchControl *control = nullptr;
+    bool pondering = false;
+    bool ponderTimeCounts = false;
+
+    // A multi-PV search finds each line by searching the root again without the moves of the lines
+    // before it. lines holds the last completed iteration's, best first.
+    int multiPv = 1;
+    MoveList rootExcluded;
+    std::vector<PositionEvaluation> lines;
+
+    bool checkLimits = false;
+    std::chrono::steady_clock::time_point clockStart;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    long budgetMillis = 0;
+    long nodeLimit = 0;
+
+    // Triangular principal variation table: pvTable[ply] holds the best line found from ply onwards.
+    Move pvTable[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY] = {};
+    Move pvLine[MAX_PLY];
+    int pvLineLength = 0;
+    bool followPv = false;
+
+    uint16_t killers[MAX_PLY][2] = {};
+    int history[2][64][64] = {};
+
+    // boards[ply] is the position at ply when searching with copy-make. accumulators[ply] goes with
+    // it; with make/unmake only accumulators[0] is used.
+    bool copyMake = false;
+    Board boards[MAX_PLY];
+    Accumulator accumulators[MAX_PLY];
+
+    explicit SearchState(TranspositionTable &tt) : tt(tt) {}
 };
 
 struct Evaluation {
     Statistics stats;
     PositionEvaluation pos;
+    // The best SearchLimits::multiPv root moves, or all there are, each with its line, best first.
+    // The first is pos.
+    std::vector<PositionEvaluation> lines;
 };
 
 std::ostream& operator<<(std::ostream &os, const Board &b);
 std::ostream& operator<<(std::ostream &os, const PieceElement &pe);
-std::ostream& operator<<(std::ostream &os, const std::vector<PieceElement> &pList);
+std::ostream& operator<<(std::ostream &os, const PieceList &pList);
 std::ostream& operator<<(std::ostream &os, const Move &m);
 std::ostream& operator<<(std::ostream &os, const std::vector<Move> &mList);
 std::ostream& operator<<(std::ostream &os, const Statistics &s);
 
 
+#ifdef CHESS_COUNT_ALLOCATIONS
+// Incremented by the replaced global operator new on every heap allocation made by this thread.
+extern thread_local long heapAllocationCount;
+#endif
+
+uint64_t zobristKey(bool isWhite, uint8_t pieceType, int rank, int file);
+uint16_t encodeMove(const Move &m);
+
 bool inCheck(const Board &b, bool isWhite);
-double sumPieceList(const std::vector<PieceElement> &pieceList);
+MoveList getMoves(Board &b, const BoardContext &bc);
+int getPieceScore(uint8_t pieceType);
+int sumPieceList(const PieceList &pieceList);
+bool isMateValue(int value);
+int movesToMate(int value);
 std::string evaluationValueToString(const PositionEvaluation &res);
 Move moveFromString(const std::string &s, const Board &b);
+bool isValidFen(const std::string &fen);
 Evaluation evaluateBoard(Board &b, int maxDepth);
+Evaluation evaluateBoard(Board &b, int maxDepth, TranspositionTable &tt, int threads = 1);
+Evaluation evaluateBoard(Board &b, const SearchLimits &limits, TranspositionTable &tt, SearchControl *control = nullptr);
 void test();
 
 void printBitBoard(uint64_t bitBoard);
@@ -0,0 +1,31 @@
+#ifndef CHESS_EVALUATION_H
+#define CHESS_EVALUATION_H
+
+#include "chess.h"
+
+const int TOTAL_PHASE = 24;
+
+// Material plus piece-square bonus for each color, piece type and square (a1 = 0), in centipawns.
+// Black's entries are mirrored and negated, so a board's score is the plain sum over its pieces
+// from white's point of view.
+struct PieceSquareTables {
+    int mg[2][7][64];
+    int eg[2][7][64];
+    int phase[7];
+};
+
+extern const PieceSquareTables PST;
+
+// Tapered between the middlegame and endgame scores by the remaining non-pawn material, relative to
+// the side to move. The scores are kept up to date by doMove/undoMove so this is O(1). The active
+// network, when one is loaded, takes over from the tables.
+inline int evaluate(Board &b) {
+    if (activeNetwork) {
+        return nnueEvaluate(b);
+    }
+    int phase = std::min(b.phase, TOTAL_PHASE);
+    int value = (b.mgScore * phase + b.egScore * (TOTAL_PHASE - phase)) / TOTAL_PHASE;
+    return b.whiteToMove ? value : -value;
+}
+
+#endif //CHESS_EVALUATION_H
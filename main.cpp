@@ -1,50 +1,511 @@
 #include <iostream>
 #include "chess.h"
+#include "perft.h"
+#include "evaluation.h"
+#include "uci.h"
+#include "batch.h"
+#include "book.h"
+#include "tablebase.h"
+#include "retrograde.h"
 
-const std::string START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+#include <fstream>
+#include <thread>
 
-void play(std::string fen, bool playerIsWhite, int depth) {
+// The engine plays from the book, when given one, for as long as it has a move for the position.
+// While the player thinks, the engine ponders: it searches the reply its principal variation
+// expects. If that reply is played the search carries on as the engine's own, with the time already
+// spent counted against its budget, and otherwise it is stopped and a new one started.
+void play(std::string fen, bool playerIsWhite, const SearchLimits &limits, size_t hashMb, const OpeningBook &book) {
     Board board(fen);
+    TranspositionTable tt(hashMb);
+    uint64_t bookRng = std::chrono::steady_clock::now().time_since_epoch().count();
+    SearchControl ponderControl;
+    std::thread ponderThread;
+    Move ponderMove;
+    bool hasPonderMove = false;
+    Evaluation ponderResult;
+    bool ponderHit = false;
+    auto endPonder = [&](bool hit) {
+        if (hit) {
+            ponderControl.pondering = false;
+        } else {
+            ponderControl.stop = true;
+        }
+        ponderThread.join();
+        ponderHit = hit;
+    };
     while (true) {
 //        std::cout << board << '\n';
         if (board.whiteToMove ==  playerIsWhite) {
             Evaluation res = evaluateBoard(board, 1);
             if (res.pos.bestMovePath.empty()) {
+                if (ponderThread.joinable()) {
+                    endPonder(false);
+                }
                 std::cout << evaluationValueToString(res.pos) << '\n';
                 return;
             }
             std::string moveStr;
             std::cin >> moveStr;
             Move move = moveFromString(moveStr, board);
+            if (ponderThread.joinable()) {
+                endPonder(hasPonderMove && move == ponderMove);
+            }
             board.doMove(move);
         } else {
-            Evaluation res = evaluateBoard(board, depth);
+            hasPonderMove = false;
+            Move bookMove;
+            if (!ponderHit && book.pickMove(board, BOOK_SELECT_WEIGHTED, bookRng, bookMove)) {
+                std::cout << bookMove << " (book)" << std::endl;
+                board.doMove(bookMove);
+                continue;
+            }
+            Evaluation res = ponderHit ? ponderResult : evaluateBoard(board, limits, tt);
             if (res.pos.bestMovePath.empty()) {
                 std::cout << evaluationValueToString(res.pos) << '\n';
                 return;
             }
             std::cout << res.stats << '\n';
             Move move = res.pos.bestMovePath[0];
-            std::cout << move << std::endl;
+            std::cout << move << (ponderHit ? " (ponderhit)" : "") << std::endl;
             board.doMove(move);
+            ponderHit = false;
+
+            // Book positions are answered from the book, so there is nothing to ponder.
+            Board ponderBoard = board;
+            if (res.pos.bestMovePath.size() > 1) {
+                ponderMove = res.pos.bestMovePath[1];
+                hasPonderMove = true;
+                ponderBoard.doMove(ponderMove);
+            }
+            if (hasPonderMove && book.probe(ponderBoard).empty()) {
+                SearchLimits ponderLimits = limits;
+                ponderLimits.ponder = true;
+                ponderLimits.ponderTimeCounts = true;
+                ponderControl.stop = false;
+                ponderControl.pondering = true;
+                ponderThread = std::thread([&, ponderBoard, ponderLimits]() mutable {
+                    ponderResult = evaluateBoard(ponderBoard, ponderLimits, tt, &ponderControl);
+                });
+            }
         }
     }
 }
 
-int main(int argc, const char* argv[]) {
+std::string fenFromArg(const std::string &arg) {
+    return arg == "start" ? START_FEN : arg;
+}
+
+int perftCommand(int argc, const char* argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: perft fen depth [divide] [threads n] [hash mb] [scale]\n";
+        return 1;
+    }
+
+    Board board(fenFromArg(argv[2]));
+    int depth = std::stoi(argv[3]);
+    bool divide = false;
+    bool scale = false;
+    int threads = 1;
+    size_t hashMb = 0;
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "divide") {
+            divide = true;
+        } else if (arg == "scale") {
+            scale = true;
+        } else if (arg == "threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (arg == "hash" && i + 1 < argc) {
+            hashMb = std::stoul(argv[++i]);
+        }
+    }
+
+    if (scale) {
+        // Doubles the thread count up to the requested maximum, with a fresh hash for each run.
+        std::vector<int> threadCounts;
+        for (int t = 1; t < threads; t *= 2) {
+            threadCounts.push_back(t);
+        }
+        threadCounts.push_back(threads);
+
+        uint64_t baseNps = 0;
+        for (int t : threadCounts) {
+            std::unique_ptr<PerftHash> hash(hashMb ? new PerftHash(hashMb) : nullptr);
+            PerftResult res = runPerft(board, depth, false, t, hash.get());
+            if (t == 1) {
+                baseNps = res.nodesPerSecond();
+            }
+            std::cout << "threads: " << t << ' ' << res << " speedup: "
+                      << (baseNps ? (double)res.nodesPerSecond() / baseNps : 0) << std::endl;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<PerftHash> hash(hashMb ? new PerftHash(hashMb) : nullptr);
+    std::cout << runPerft(board, depth, divide, threads, hash.get()) << std::endl;
+    return 0;
+}
+
+void evalWalk(Board &b, int depth, long &evals, long &checksum) {
+    checksum += evaluate(b);
+    evals++;
+    if (depth == 0) {
+        return;
+    }
+    BoardContext bc(b);
+    for (const Move &m : getMoves(b, bc)) {
+        b.doMove(m);
+        evalWalk(b, depth - 1, evals, checksum);
+        b.undoMove(m);
+    }
+}
+
+// Evaluates every node of a fixed-depth tree, so incremental updates are included in the rate. Each
+// available network kernel must produce the same checksum as the scalar one.
+long runEvalBench(const std::string &name, int depth) {
+    const std::string fens[] = {START_FEN, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w - - 0 1"};
+    long evals = 0;
+    long checksum = 0;
+    Accumulator accumulator;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string &fen : fens) {
+        Board board(fen);
+        attachAccumulator(board, &accumulator);
+        evalWalk(board, depth, evals, checksum);
+    }
+    auto end = std::chrono::steady_clock::now();
+    long micros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    std::cout << name << " evals: " << evals << " timeMillis: " << micros / 1000
+              << " evalsPerSecond: " << (micros ? evals * 1000000 / micros : 0) << " checksum: " << checksum << std::endl;
+    return checksum;
+}
+
+int evalBenchCommand(int argc, const char* argv[]) {
+    std::string evalFile = argc > 2 ? argv[2] : "random";
+    int depth = argc > 3 ? std::stoi(argv[3]) : 4;
+
+    runEvalBench("pst", depth);
+
+    std::unique_ptr<Network> randomNetwork;
+    if (evalFile == "random") {
+        randomNetwork.reset(new Network());
+        randomizeNetwork(*randomNetwork, 1);
+        setActiveNetwork(randomNetwork.get());
+    } else if (!loadNetwork(evalFile)) {
+        std::cout << "Could not load network " << evalFile << '\n';
+        return 1;
+    }
+
+    long expected = 0;
+    for (int kernel = NNUE_KERNEL_SCALAR; kernel <= NNUE_KERNEL_AVX2; kernel++) {
+        if (!setNnueKernel(kernel)) {
+            continue;
+        }
+        long checksum = runEvalBench(std::string("nnue-") + nnueKernelName(kernel), depth);
+        if (kernel == NNUE_KERNEL_SCALAR) {
+            expected = checksum;
+        } else if (checksum != expected) {
+            std::cout << "checksum mismatch against scalar kernel\n";
+            return 1;
+        }
+    }
+    setActiveNetwork(nullptr);
+    return 0;
+}
+
+// Fixed-depth perft and search over a set of positions, to compare move generation and search speed
+// between builds. Each search is run with make/unmake and again with copy-make, which must visit the
+// same nodes. Selective search techniques can be switched off to see what each one saves in time to
+// depth. The fens avoid castling and en passant, which the board doesn't support.
+const std::string BENCH_FENS[] = {
+        START_FEN,
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w - - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w - - 0 1",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+};
+
+int benchCommand(int argc, const char* argv[]) {
+    int perftDepth = argc > 2 ? std::stoi(argv[2]) : 5;
+    int searchDepth = argc > 3 ? std::stoi(argv[3]) : 8;
+    SearchFeatures features;
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "no-nullmove") {
+            features.nullMove = false;
+        } else if (arg == "no-lmr") {
+            features.lateMoveReductions = false;
+        } else if (arg == "no-futility") {
+            features.futility = false;
+        }
+    }
+    TranspositionTable tt(DEFAULT_HASH_MB);
+    uint64_t perftNodes = 0;
+    long perftMicros = 0;
+    long searchNodes = 0;
+    long searchMillis = 0;
+    long copyMakeMillis = 0;
+    for (const std::string &fen : BENCH_FENS) {
+        Board board(fen);
+        PerftResult perftRes = runPerft(board, perftDepth, false);
+        std::cout << fen << "\n  perft " << perftRes << '\n';
+        long nodes[2];
+        for (int copyMake = 0; copyMake < 2; copyMake++) {
+            SearchLimits limits;
+            limits.depth = searchDepth;
+            limits.copyMake = copyMake;
+            limits.features = features;
+            tt.clear();
+            Evaluation searchRes = evaluateBoard(board, limits, tt);
+            nodes[copyMake] = searchRes.stats.methodCalls + searchRes.stats.quiescenceNodes;
+            long millis = searchRes.stats.evaluationDurationMillis;
+            std::cout << (copyMake ? "  copy-make" : "  make/unmake") << " search nodes: " << nodes[copyMake]
+                      << " timeMillis: " << millis << " nps: " << (millis ? nodes[copyMake] * 1000 / millis : 0) << '\n';
+            (copyMake ? copyMakeMillis : searchMillis) += millis;
+        }
+        if (nodes[0] != nodes[1]) {
+            std::cout << "copy-make searched a different tree\n";
+            return 1;
+        }
+        perftNodes += perftRes.nodes;
+        perftMicros += perftRes.durationMicros;
+        searchNodes += nodes[0];
+    }
+    std::cout << "total perft nodes: " << perftNodes << " nps: " << (perftMicros ? perftNodes * 1000000 / perftMicros : 0)
+              << " search nodes: " << searchNodes << " nps: " << (searchMillis ? searchNodes * 1000 / searchMillis : 0)
+              << " copy-make nps: " << (copyMakeMillis ? searchNodes * 1000 / copyMakeMillis : 0)
+              << " sizeof(Board): " << sizeof(Board) << std::endl;
+    return 0;
+}
+
+// The engine's limit is a depth, or a fixed time per move when given with an "ms" suffix.
+void parseLimitArg(const std::string &arg, SearchLimits &limits) {
+    if (arg.size() > 2 && arg.compare(arg.size() - 2, 2, "ms") == 0) {
+        limits.moveTimeMillis = std::stol(arg);
+    } else {
+        limits.depth = std::stoi(arg);
+    }
+}
+
+// Prints the best multipv moves of a position, each with its value for white and its line.
+int analyzeCommand(int argc, const char* argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: analyze fen depth|moveTimeMs [multipv k] [threads n] [hash mb]\n";
+        return 1;
+    }
+
+    Board board(fenFromArg(argv[2]));
+    SearchLimits limits;
+    parseLimitArg(argv[3], limits);
+    size_t hashMb = DEFAULT_HASH_MB;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "multipv") {
+            limits.multiPv = std::stoi(argv[i + 1]);
+        } else if (arg == "threads") {
+            limits.threads = std::stoi(argv[i + 1]);
+        } else if (arg == "hash") {
+            hashMb = std::stoul(argv[i + 1]);
+        }
+    }
+
+    TranspositionTable tt(hashMb);
+    Evaluation res = evaluateBoard(board, limits, tt);
+    for (int i = 0; i < (int)res.lines.size(); i++) {
+        std::cout << i + 1 << ". " << evaluationValueToString(res.lines[i]) << ' ' << res.lines[i].bestMovePath << '\n';
+    }
+    std::cout << res.stats << std::endl;
+    return 0;
+}
+
+// Searches the bench positions to the same depth with 1 up to maxMultiPv lines. Each line after the
+// first searches the root again without the moves already found, reusing the transposition table,
+// so a line costs less than a search of its own.
+int multiPvBenchCommand(int argc, const char* argv[]) {
+    int searchDepth = argc > 2 ? std::stoi(argv[2]) : 7;
+    int maxMultiPv = argc > 3 ? std::stoi(argv[3]) : 8;
+
+    TranspositionTable tt(DEFAULT_HASH_MB);
+    long singleNodes = 0;
+    for (int multiPv = 1; multiPv <= maxMultiPv; multiPv++) {
+        long nodes = 0;
+        long millis = 0;
+        for (const std::string &fen : BENCH_FENS) {
+            Board board(fen);
+            SearchLimits limits;
+            limits.depth = searchDepth;
+            limits.multiPv = multiPv;
+            tt.clear();
+            Evaluation res = evaluateBoard(board, limits, tt);
+            nodes += res.stats.methodCalls + res.stats.quiescenceNodes;
+            millis += res.stats.evaluationDurationMillis;
+        }
+        if (multiPv == 1) {
+            singleNodes = nodes;
+        }
+        std::cout << "multipv: " << multiPv << " nodes: " << nodes << " timeMillis: " << millis
+                  << " nodesVsSinglePv: " << (singleNodes ? (double)nodes / singleNodes : 0) << std::endl;
+    }
+    return 0;
+}
+
+int batchCommand(int argc, const char* argv[]) {
     if (argc < 4) {
-        std::cout << "Usage: fen playerColor engineDepth";
+        std::cout << "Usage: batch file|- depth|moveTimeMs [workers n] [hash mb]\n";
+        return 1;
+    }
+
+    BatchOptions options;
+    parseLimitArg(argv[3], options.limits);
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "workers") {
+            options.workers = std::stoi(argv[i + 1]);
+        } else if (arg == "hash") {
+            options.hashMb = std::stoul(argv[i + 1]);
+        }
+    }
+
+    std::string path = argv[2];
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            std::cout << "Could not open " << path << '\n';
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    long positions = runBatch(path == "-" ? std::cin : file, std::cout, options);
+    long millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "positions: " << positions << " workers: " << options.workers << " timeMillis: " << millis
+              << " positionsPerSecond: " << (millis ? positions * 1000.0 / millis : 0) << std::endl;
+    return 0;
+}
+
+// Tables are named like KQvKR, or a piece count names every table up to it. Generation time is
+// mostly move generation, so the totals double as a movegen benchmark.
+int tbgenCommand(int argc, const char* argv[]) {
+    std::vector<std::string> names;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string saveDirectory;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (arg == "save" && i + 1 < argc) {
+            saveDirectory = argv[++i];
+        } else if (std::isdigit(arg[0])) {
+            std::vector<std::string> counted = tablebaseNames(std::stoi(arg));
+            names.insert(names.end(), counted.begin(), counted.end());
+        } else {
+            names.push_back(arg);
+        }
+    }
+    if (names.empty()) {
+        std::cout << "Usage: tbgen pieces|name... [threads n] [save dir]\n";
+        return 1;
+    }
+
+    std::vector<GenerationResult> results;
+    for (const std::string &name : names) {
+        size_t generated = results.size();
+        if (!generateTablebase(name, threads, results)) {
+            std::cout << "Could not generate " << name << '\n';
+            return 1;
+        }
+        for (size_t i = generated; i < results.size(); i++) {
+            std::cout << results[i] << std::endl;
+            if (!saveDirectory.empty() && !saveTablebase(results[i].name, saveDirectory)) {
+                std::cout << "Could not save " << results[i].name << " to " << saveDirectory << '\n';
+                return 1;
+            }
+        }
+    }
+
+    GenerationResult total;
+    total.name = "total";
+    for (const GenerationResult &res : results) {
+        total.positions += res.positions;
+        total.wins += res.wins;
+        total.draws += res.draws;
+        total.losses += res.losses;
+        total.maxDtm = std::max(total.maxDtm, res.maxDtm);
+        total.passes += res.passes;
+        total.positionsSearched += res.positionsSearched;
+        total.movesMade += res.movesMade;
+        total.durationMicros += res.durationMicros;
+    }
+    std::cout << total << " threads: " << threads << std::endl;
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    // GUIs start the engine without arguments and talk UCI over stdin.
+    if (argc == 1 || std::string(argv[1]) == "uci") {
+        UciEngine engine;
+        engine.loop(std::cin);
+        return 0;
+    }
+    if (std::string(argv[1]) == "perft") {
+        return perftCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "evalbench") {
+        return evalBenchCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "batch") {
+        return batchCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "bench") {
+        return benchCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "tbgen") {
+        return tbgenCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "analyze") {
+        return analyzeCommand(argc, argv);
+    }
+    if (std::string(argv[1]) == "multipvbench") {
+        return multiPvBenchCommand(argc, argv);
     }
 
-    std::string fen = argv[1];
-    if (fen == "start") {
-        fen = START_FEN;
+    if (argc < 4) {
+        std::cout << "Usage: fen playerColor engineDepth|moveTimeMs [hashMb] [threads] [evalFile|-] [bookFile|-] [tablebaseDir]\n";
+        std::cout << "       perft fen depth [divide] [threads n] [hash mb] [scale]\n";
+        std::cout << "       evalbench [evalFile|random] [depth]\n";
+        std::cout << "       batch file|- depth|moveTimeMs [workers n] [hash mb]\n";
+        std::cout << "       bench [perftDepth] [searchDepth] [no-nullmove] [no-lmr] [no-futility]\n";
+        std::cout << "       tbgen pieces|name... [threads n] [save dir]\n";
+        std::cout << "       analyze fen depth|moveTimeMs [multipv k] [threads n] [hash mb]\n";
+        std::cout << "       multipvbench [searchDepth] [maxMultiPv]\n";
+        std::cout << "       uci (also the default without arguments)\n";
+        return 1;
     }
 
+    std::string fen = fenFromArg(argv[1]);
+
     bool playerIsWhite = std::string(argv[2]) == "w";
-    int depth = std::stoi(argv[3]);
+    SearchLimits limits;
+    parseLimitArg(argv[3], limits);
+    size_t hashMb = argc > 4 ? std::stoul(argv[4]) : DEFAULT_HASH_MB;
+    limits.threads = argc > 5 ? std::stoi(argv[5]) : 1;
+    if (argc > 6 && std::string(argv[6]) != "-" && !loadNetwork(argv[6])) {
+        std::cout << "Could not load network " << argv[6] << '\n';
+        return 1;
+    }
+    OpeningBook book;
+    if (argc > 7 && std::string(argv[7]) != "-" && !book.open(argv[7])) {
+        std::cout << "Could not load book " << argv[7] << '\n';
+        return 1;
+    }
+
+    if (argc > 8) {
+        std::cout << "Loaded " << loadTablebases(argv[8]) << " tablebases\n";
+    }
 
-    play(fen, playerIsWhite, depth);
+    play(fen, playerIsWhite, limits, hashMb, book);
 
     return 0;
 
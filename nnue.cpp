@@ -0,0 +1,403 @@
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+#include "chess.h"
+#include "nnue.h"
+
+const char NNUE_MAGIC[8] = {'C', 'H', 'S', 'N', 'N', 'U', 'E', '1'};
+
+const Network *activeNetwork = nullptr;
+std::unique_ptr<Network> loadedNetwork;
+
+// Each kernel does the same integer arithmetic in the same order of saturation and rounding, so
+// every path produces bit-identical accumulators and outputs.
+struct NnueKernels {
+    void (*updateAccumulator)(int16_t *acc, const int16_t *const *added, int addedCount, const int16_t *const *removed, int removedCount);
+    int32_t (*propagate)(const Network &net, const int16_t *us, const int16_t *them);
+};
+
+inline int clipped(int32_t value) {
+    return std::max(0, std::min(127, value));
+}
+
+void updateAccumulatorScalar(int16_t *acc, const int16_t *const *added, int addedCount, const int16_t *const *removed, int removedCount) {
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        int16_t value = acc[i];
+        for (int j = 0; j < addedCount; j++) {
+            value = (int16_t)(value + added[j][i]);
+        }
+        for (int j = 0; j < removedCount; j++) {
+            value = (int16_t)(value - removed[j][i]);
+        }
+        acc[i] = value;
+    }
+}
+
+int32_t outputLayers(const Network &net, const uint8_t *l1Out) {
+    uint8_t l2Out[NNUE_L2];
+    for (int o = 0; o < NNUE_L2; o++) {
+        int32_t sum = net.l2Bias[o];
+        for (int i = 0; i < NNUE_L1; i++) {
+            sum += net.l2Weights[o][i] * l1Out[i];
+        }
+        l2Out[o] = clipped(sum >> NNUE_WEIGHT_SHIFT);
+    }
+    int32_t out = net.outputBias;
+    for (int i = 0; i < NNUE_L2; i++) {
+        out += net.outputWeights[i] * l2Out[i];
+    }
+    return out;
+}
+
+int32_t propagateScalar(const Network &net, const int16_t *us, const int16_t *them) {
+    uint8_t input[2 * NNUE_HIDDEN];
+    for (int i = 0; i < NNUE_HIDDEN; i++) {
+        input[i] = clipped(us[i]);
+        input[NNUE_HIDDEN + i] = clipped(them[i]);
+    }
+    uint8_t l1Out[NNUE_L1];
+    for (int o = 0; o < NNUE_L1; o++) {
+        int32_t sum = net.l1Bias[o];
+        for (int i = 0; i < 2 * NNUE_HIDDEN; i++) {
+            sum += net.l1Weights[o][i] * input[i];
+        }
+        l1Out[o] = clipped(sum >> NNUE_WEIGHT_SHIFT);
+    }
+    return outputLayers(net, l1Out);
+}
+
+#ifdef NNUE_X86
+
+// maddubs multiplies unsigned inputs of at most 127 with signed weights and adds adjacent pairs into
+// int16, which can't saturate: 2 * 127 * 128 < 32768.
+__attribute__((target("ssse3")))
+void updateAccumulatorSsse3(int16_t *acc, const int16_t *const *added, int addedCount, const int16_t *const *removed, int removedCount) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i value = _mm_load_si128((const __m128i*)(acc + i));
+        for (int j = 0; j < addedCount; j++) {
+            value = _mm_add_epi16(value, _mm_load_si128((const __m128i*)(added[j] + i)));
+        }
+        for (int j = 0; j < removedCount; j++) {
+            value = _mm_sub_epi16(value, _mm_load_si128((const __m128i*)(removed[j] + i)));
+        }
+        _mm_store_si128((__m128i*)(acc + i), value);
+    }
+}
+
+__attribute__((target("ssse3")))
+int32_t horizontalSumSsse3(__m128i sum) {
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("ssse3")))
+int32_t propagateSsse3(const Network &net, const int16_t *us, const int16_t *them) {
+    alignas(64) uint8_t input[2 * NNUE_HIDDEN];
+    const __m128i zero = _mm_setzero_si128();
+    for (int side = 0; side < 2; side++) {
+        const int16_t *acc = side == 0 ? us : them;
+        for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+            // No signed byte max before SSE4.1, so clamp at 0 in int16 before packing.
+            __m128i packed = _mm_packs_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(acc + i)), zero),
+                                     _mm_max_epi16(_mm_load_si128((const __m128i*)(acc + i + 8)), zero));
+            _mm_store_si128((__m128i*)(input + side * NNUE_HIDDEN + i), packed);
+        }
+    }
+
+    const __m128i ones = _mm_set1_epi16(1);
+    uint8_t l1Out[NNUE_L1];
+    for (int o = 0; o < NNUE_L1; o++) {
+        __m128i sum = _mm_setzero_si128();
+        for (int i = 0; i < 2 * NNUE_HIDDEN; i += 16) {
+            __m128i products = _mm_maddubs_epi16(_mm_load_si128((const __m128i*)(input + i)),
+                                                 _mm_load_si128((const __m128i*)(net.l1Weights[o] + i)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+        }
+        l1Out[o] = clipped((net.l1Bias[o] + horizontalSumSsse3(sum)) >> NNUE_WEIGHT_SHIFT);
+    }
+    return outputLayers(net, l1Out);
+}
+
+__attribute__((target("avx2")))
+void updateAccumulatorAvx2(int16_t *acc, const int16_t *const *added, int addedCount, const int16_t *const *removed, int removedCount) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i value = _mm256_load_si256((const __m256i*)(acc + i));
+        for (int j = 0; j < addedCount; j++) {
+            value = _mm256_add_epi16(value, _mm256_load_si256((const __m256i*)(added[j] + i)));
+        }
+        for (int j = 0; j < removedCount; j++) {
+            value = _mm256_sub_epi16(value, _mm256_load_si256((const __m256i*)(removed[j] + i)));
+        }
+        _mm256_store_si256((__m256i*)(acc + i), value);
+    }
+}
+
+__attribute__((target("avx2")))
+int32_t propagateAvx2(const Network &net, const int16_t *us, const int16_t *them) {
+    alignas(64) uint8_t input[2 * NNUE_HIDDEN];
+    const __m256i zero = _mm256_setzero_si256();
+    for (int side = 0; side < 2; side++) {
+        const int16_t *acc = side == 0 ? us : them;
+        for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+            __m256i packed = _mm256_packs_epi16(_mm256_load_si256((const __m256i*)(acc + i)), _mm256_load_si256((const __m256i*)(acc + i + 16)));
+            // packs interleaves the 128-bit lanes of its two arguments; put them back in order.
+            packed = _mm256_max_epi8(_mm256_permute4x64_epi64(packed, 0xD8), zero);
+            _mm256_store_si256((__m256i*)(input + side * NNUE_HIDDEN + i), packed);
+        }
+    }
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    uint8_t l1Out[NNUE_L1];
+    for (int o = 0; o < NNUE_L1; o++) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < 2 * NNUE_HIDDEN; i += 32) {
+            __m256i products = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i*)(input + i)),
+                                                    _mm256_load_si256((const __m256i*)(net.l1Weights[o] + i)));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+        l1Out[o] = clipped((net.l1Bias[o] + _mm_cvtsi128_si32(half)) >> NNUE_WEIGHT_SHIFT);
+    }
+    return outputLayers(net, l1Out);
+}
+
+#endif
+
+const NnueKernels KERNELS[3] = {
+    {updateAccumulatorScalar, propagateScalar},
+#ifdef NNUE_X86
+    {updateAccumulatorSsse3, propagateSsse3},
+    {updateAccumulatorAvx2, propagateAvx2},
+#else
+    {updateAccumulatorScalar, propagateScalar},
+    {updateAccumulatorScalar, propagateScalar},
+#endif
+};
+
+bool nnueKernelSupported(int kernel) {
+    switch (kernel) {
+        case NNUE_KERNEL_SCALAR: return true;
+#ifdef NNUE_X86
+        case NNUE_KERNEL_SSSE3: return __builtin_cpu_supports("ssse3");
+        case NNUE_KERNEL_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+int bestNnueKernel() {
+    for (int kernel = NNUE_KERNEL_AVX2; kernel > NNUE_KERNEL_SCALAR; kernel--) {
+        if (nnueKernelSupported(kernel)) {
+            return kernel;
+        }
+    }
+    return NNUE_KERNEL_SCALAR;
+}
+
+int nnueKernel = bestNnueKernel();
+
+bool setNnueKernel(int kernel) {
+    if (!nnueKernelSupported(kernel)) {
+        return false;
+    }
+    nnueKernel = kernel;
+    return true;
+}
+
+int getNnueKernel() {
+    return nnueKernel;
+}
+
+const char* nnueKernelName(int kernel) {
+    switch (kernel) {
+        case NNUE_KERNEL_SSSE3: return "ssse3";
+        case NNUE_KERNEL_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+bool loadNetwork(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(NNUE_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, NNUE_MAGIC, sizeof(magic)) != 0) {
+        return false;
+    }
+    std::unique_ptr<Network> net(new Network());
+    bool ok = in.read((char*)net->featureWeights, sizeof(net->featureWeights)) &&
+              in.read((char*)net->featureBias, sizeof(net->featureBias)) &&
+              in.read((char*)net->l1Weights, sizeof(net->l1Weights)) &&
+              in.read((char*)net->l1Bias, sizeof(net->l1Bias)) &&
+              in.read((char*)net->l2Weights, sizeof(net->l2Weights)) &&
+              in.read((char*)net->l2Bias, sizeof(net->l2Bias)) &&
+              in.read((char*)net->outputWeights, sizeof(net->outputWeights)) &&
+              in.read((char*)&net->outputBias, sizeof(net->outputBias));
+    if (!ok) {
+        return false;
+    }
+    loadedNetwork = std::move(net);
+    activeNetwork = loadedNetwork.get();
+    return true;
+}
+
+void setActiveNetwork(const Network *network) {
+    activeNetwork = network;
+}
+
+// Small random weights, only useful for benchmarking the inference code without a trained file.
+void randomizeNetwork(Network &network, uint64_t seed) {
+    auto next = [&seed](int range) {
+        return (int)(splitMix64(seed) % (2 * range + 1)) - range;
+    };
+    for (auto &row : network.featureWeights) {
+        for (int16_t &w : row) {
+            w = next(32);
+        }
+    }
+    for (int16_t &b : network.featureBias) {
+        b = next(64);
+    }
+    for (auto &row : network.l1Weights) {
+        for (int8_t &w : row) {
+            w = next(64);
+        }
+    }
+    for (int32_t &b : network.l1Bias) {
+        b = next(2048);
+    }
+    for (auto &row : network.l2Weights) {
+        for (int8_t &w : row) {
+            w = next(64);
+        }
+    }
+    for (int32_t &b : network.l2Bias) {
+        b = next(2048);
+    }
+    for (int8_t &w : network.outputWeights) {
+        w = next(64);
+    }
+    network.outputBias = 0;
+}
+
+// Pieces are seen from the perspective's side of the board, so black's squares are flipped.
+inline int featureIndex(int perspective, int kingSq, bool pieceIsWhite, uint8_t pieceType, int sq) {
+    if (perspective == 1) {
+        kingSq ^= 56;
+        sq ^= 56;
+    }
+    int theirs = colorIdx(pieceIsWhite) == perspective ? 0 : 1;
+    return kingSq * NNUE_PIECE_SQUARES + ((pieceType - QUEEN) * 2 + theirs) * 64 + sq;
+}
+
+inline int kingSquare(const Board &b, int perspective) {
+    const PieceElement &king = perspective == 0 ? b.whitePieces[0] : b.blackPieces[0];
+    return getBitIdx(king.rank, king.file);
+}
+
+void refreshAccumulator(const Board &b, Accumulator &accumulator, int perspective) {
+    accumulator.pendingKingMoves[perspective] = 0;
+    accumulator.needsRefresh[perspective] = false;
+    int16_t *acc = accumulator.values[perspective];
+    std::memcpy(acc, activeNetwork->featureBias, sizeof(activeNetwork->featureBias));
+    int kingSq = kingSquare(b, perspective);
+    for (int color = 0; color < 2; color++) {
+        for (const PieceElement &pe : color == 0 ? b.whitePieces : b.blackPieces) {
+            if (pe.pieceType == KING) {
+                continue;
+            }
+            const int16_t *added = activeNetwork->featureWeights[featureIndex(perspective, kingSq, color == 0, pe.pieceType, getBitIdx(pe.rank, pe.file))];
+            KERNELS[nnueKernel].updateAccumulator(acc, &added, 1, nullptr, 0);
+        }
+    }
+}
+
+void refreshAccumulator(Board &b, int perspective) {
+    refreshAccumulator(b, *b.accumulator, perspective);
+}
+
+void refreshAccumulators(Board &b) {
+    refreshAccumulator(b, 0);
+    refreshAccumulator(b, 1);
+}
+
+void attachAccumulator(Board &b, Accumulator *acc) {
+    b.accumulator = acc;
+    if (acc && activeNetwork) {
+        refreshAccumulators(b);
+    }
+}
+
+// Called once the board itself has been updated. Making a move removes the piece from its start
+// square and any captured piece, and adds the (possibly promoted) piece on its destination; undoing
+// it does the reverse. Kings aren't features, so a king move only matters to the other side when it
+// captures.
+void updateAccumulators(Board &b, const Move &m, bool moverIsWhite, bool undo) {
+    Accumulator &acc = *b.accumulator;
+    int startSq = getBitIdx(m.startRank, m.startFile);
+    int destSq = getBitIdx(m.destRank, m.destFile);
+    uint8_t destType = m.promoteType ? m.promoteType : m.pieceType;
+    for (int perspective = 0; perspective < 2; perspective++) {
+        if (acc.needsRefresh[perspective]) {
+            continue;
+        }
+        if (m.pieceType == KING && colorIdx(moverIsWhite) == perspective) {
+            if (!undo) {
+                acc.pendingKingMoves[perspective]++;
+            } else if (acc.pendingKingMoves[perspective] > 0) {
+                acc.pendingKingMoves[perspective]--;
+            } else {
+                acc.needsRefresh[perspective] = true;
+            }
+            continue;
+        }
+        if (acc.pendingKingMoves[perspective] > 0) {
+            continue;
+        }
+
+        int kingSq = kingSquare(b, perspective);
+        const int16_t *added[2];
+        const int16_t *removed[2];
+        int addedCount = 0;
+        int removedCount = 0;
+        if (m.pieceType != KING) {
+            const int16_t *start = activeNetwork->featureWeights[featureIndex(perspective, kingSq, moverIsWhite, m.pieceType, startSq)];
+            const int16_t *dest = activeNetwork->featureWeights[featureIndex(perspective, kingSq, moverIsWhite, destType, destSq)];
+            added[addedCount++] = undo ? start : dest;
+            removed[removedCount++] = undo ? dest : start;
+        }
+        if (m.captureType != EMPTY && m.captureType != KING) {
+            const int16_t *captured = activeNetwork->featureWeights[featureIndex(perspective, kingSq, !moverIsWhite, m.captureType, destSq)];
+            if (undo) {
+                added[addedCount++] = captured;
+            } else {
+                removed[removedCount++] = captured;
+            }
+        }
+        if (addedCount || removedCount) {
+            KERNELS[nnueKernel].updateAccumulator(acc.values[perspective], added, addedCount, removed, removedCount);
+        }
+    }
+}
+
+// Relative to the side to move, in centipawns, and kept clear of the mate range.
+int nnueEvaluate(Board &b) {
+    Accumulator local;
+    Accumulator &acc = b.accumulator ? *b.accumulator : local;
+    for (int perspective = 0; perspective < 2; perspective++) {
+        if (!b.accumulator || acc.needsRefresh[perspective] || acc.pendingKingMoves[perspective]) {
+            refreshAccumulator(b, acc, perspective);
+        }
+    }
+    int stm = colorIdx(b.whiteToMove);
+    int32_t out = KERNELS[nnueKernel].propagate(*activeNetwork, acc.values[stm], acc.values[!stm]);
+    int limit = CHECKMATE_VALUE - MAX_PLY - 1;
+    return std::max(-limit, std::min(limit, out / NNUE_OUTPUT_SCALE));
+}
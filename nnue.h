@@ -0,0 +1,71 @@
+#ifndef CHESS_NNUE_H
+#define CHESS_NNUE_H
+
+#include <cstdint>
+#include <string>
+
+// HalfKP-style network: each perspective sees its own king square combined with every other
+// (non-king) piece and square, feeding a 256 wide int16 accumulator per side. The two accumulators,
+// side to move first, go through two clipped-ReLU int8 layers to a single output.
+const int NNUE_PIECE_SQUARES = 10 * 64;
+const int NNUE_INPUTS = 64 * NNUE_PIECE_SQUARES;
+const int NNUE_HIDDEN = 256;
+const int NNUE_L1 = 32;
+const int NNUE_L2 = 32;
+const int NNUE_WEIGHT_SHIFT = 6;
+const int NNUE_OUTPUT_SCALE = 16;
+
+const int NNUE_KERNEL_SCALAR = 0;
+const int NNUE_KERNEL_SSSE3 = 1;
+const int NNUE_KERNEL_AVX2 = 2;
+
+// Weight file layout, all little-endian: the 8 byte magic "CHSNNUE1", then featureWeights,
+// featureBias, l1Weights, l1Bias, l2Weights, l2Bias, outputWeights and outputBias exactly as laid
+// out below without padding.
+struct Network {
+    alignas(64) int16_t featureWeights[NNUE_INPUTS][NNUE_HIDDEN];
+    alignas(64) int16_t featureBias[NNUE_HIDDEN];
+    alignas(64) int8_t l1Weights[NNUE_L1][2 * NNUE_HIDDEN];
+    int32_t l1Bias[NNUE_L1];
+    alignas(64) int8_t l2Weights[NNUE_L2][NNUE_L1];
+    int32_t l2Bias[NNUE_L2];
+    alignas(64) int8_t outputWeights[NNUE_L2];
+    int32_t outputBias;
+};
+
+// A king move changes every feature of its own perspective, so instead of rebuilding that side on
+// each king move it is left as it was and marked stale until the next evaluation. A king move whose
+// subtree ends without one, on a transposition table cutoff or a tablebase hit, then costs nothing,
+// and undoing all pending king moves makes it valid again.
+struct Accumulator {
+    alignas(64) int16_t values[2][NNUE_HIDDEN];
+    int pendingKingMoves[2];
+    bool needsRefresh[2];
+};
+
+struct Board;
+struct Move;
+
+// The network used by evaluate(), or nullptr to use the piece-square tables. A board only keeps an
+// accumulator up to date while a network is active and one is attached to it, so attach it after
+// loading the network.
+extern const Network *activeNetwork;
+
+bool loadNetwork(const std::string &path);
+void setActiveNetwork(const Network *network);
+void randomizeNetwork(Network &network, uint64_t seed);
+
+bool nnueKernelSupported(int kernel);
+bool setNnueKernel(int kernel);
+int getNnueKernel();
+const char* nnueKernelName(int kernel);
+
+// Points b at acc, which may be nullptr, and brings it up to date with b. Copies of b share it, so
+// each thread needs its own. Without one nnueEvaluate rebuilds the first layer on every call.
+void attachAccumulator(Board &b, Accumulator *acc);
+void refreshAccumulator(Board &b, int perspective);
+void refreshAccumulators(Board &b);
+void updateAccumulators(Board &b, const Move &m, bool moverIsWhite, bool undo);
+int nnueEvaluate(Board &b);
+
+#endif //CHESS_NNUE_H
@@ -0,0 +1,169 @@
+#include <thread>
+
+#include "perft.h"
+
+// Work is split this many plies below the root so that threads can keep pulling small
+// subtrees off a shared counter instead of idling behind one large root move.
+const int PERFT_SPLIT_DEPTH = 2;
+
+PerftHash::PerftHash(size_t megabytes) {
+    size_t count = 1;
+    while (count * 2 * sizeof(Entry) <= megabytes * 1024 * 1024) {
+        count *= 2;
+    }
+    entries.reset(new Entry[count]);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].keyXorData.store(0, std::memory_order_relaxed);
+        entries[i].data.store(0, std::memory_order_relaxed);
+    }
+    mask = count - 1;
+}
+
+bool PerftHash::probe(uint64_t hash, int depth, uint64_t &nodes) const {
+    const Entry &e = entries[hash & mask];
+    uint64_t data = e.data.load(std::memory_order_relaxed);
+    uint64_t keyXorData = e.keyXorData.load(std::memory_order_relaxed);
+    if ((keyXorData ^ data) != hash || (data & 0xFFu) != (uint64_t)depth) {
+        return false;
+    }
+    nodes = data >> 8u;
+    return true;
+}
+
+void PerftHash::store(uint64_t hash, int depth, uint64_t nodes) {
+    Entry &e = entries[hash & mask];
+    uint64_t data = (nodes << 8u) | (uint64_t)depth;
+    e.keyXorData.store(hash ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_relaxed);
+}
+
+// Counts leaf nodes. The last ply is bulk counted from the size of the move list instead of
+// making each move, so the result mostly measures getMoves.
+uint64_t perft(Board &b, int depth) {
+    BoardContext bc(b);
+    MoveList moves = getMoves(b, bc);
+    if (depth <= 1) {
+        return depth == 1 ? moves.size() : 1;
+    }
+
+    uint64_t nodes = 0;
+    for (const Move &m : moves) {
+        b.doMove(m);
+        nodes += perft(b, depth - 1);
+        b.undoMove(m);
+    }
+    return nodes;
+}
+
+uint64_t perft(Board &b, int depth, PerftHash &hash) {
+    if (depth <= 1) {
+        return perft(b, depth);
+    }
+
+    uint64_t nodes = 0;
+    if (hash.probe(b.hash, depth, nodes)) {
+        return nodes;
+    }
+
+    BoardContext bc(b);
+    for (const Move &m : getMoves(b, bc)) {
+        b.doMove(m);
+        nodes += perft(b, depth - 1, hash);
+        b.undoMove(m);
+    }
+    hash.store(b.hash, depth, nodes);
+    return nodes;
+}
+
+struct PerftWork {
+    int rootIdx;
+    std::vector<Move> path;
+    uint64_t nodes;
+};
+
+void addPerftWork(std::vector<PerftWork> &work, Board &b, int rootIdx, std::vector<Move> &path, int splitDepth) {
+    if (splitDepth == 0) {
+        work.push_back(PerftWork{rootIdx, path, 0});
+        return;
+    }
+    BoardContext bc(b);
+    for (const Move &m : getMoves(b, bc)) {
+        b.doMove(m);
+        path.push_back(m);
+        addPerftWork(work, b, rootIdx, path, splitDepth - 1);
+        path.pop_back();
+        b.undoMove(m);
+    }
+}
+
+void runPerftWork(const Board &root, std::vector<PerftWork> &work, std::atomic<size_t> &nextWork, int depth, PerftHash *hash) {
+    Board b(root);
+    for (size_t i = nextWork++; i < work.size(); i = nextWork++) {
+        PerftWork &w = work[i];
+        for (const Move &m : w.path) {
+            b.doMove(m);
+        }
+        int remaining = depth - (int)w.path.size();
+        w.nodes = hash ? perft(b, remaining, *hash) : perft(b, remaining);
+        for (auto it = w.path.rbegin(); it != w.path.rend(); it++) {
+            b.undoMove(*it);
+        }
+    }
+}
+
+PerftResult runPerft(Board &b, int depth, bool divide, int threads, PerftHash *hash) {
+    PerftResult res;
+    auto start = std::chrono::steady_clock::now();
+    if (depth > 0) {
+        BoardContext bc(b);
+        MoveList rootMoves = getMoves(b, bc);
+        int splitDepth = std::min(depth - 1, threads > 1 ? PERFT_SPLIT_DEPTH - 1 : 0);
+
+        std::vector<PerftWork> work;
+        std::vector<Move> path;
+        for (int i = 0; i < rootMoves.size(); i++) {
+            b.doMove(rootMoves[i]);
+            path.push_back(rootMoves[i]);
+            addPerftWork(work, b, i, path, splitDepth);
+            path.pop_back();
+            b.undoMove(rootMoves[i]);
+        }
+
+        std::atomic<size_t> nextWork(0);
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back(runPerftWork, std::cref(b), std::ref(work), std::ref(nextWork), depth, hash);
+        }
+        runPerftWork(b, work, nextWork, depth, hash);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+
+        std::vector<uint64_t> rootNodes(rootMoves.size(), 0);
+        for (const PerftWork &w : work) {
+            rootNodes[w.rootIdx] += w.nodes;
+            res.nodes += w.nodes;
+        }
+        if (divide) {
+            for (int i = 0; i < rootMoves.size(); i++) {
+                res.divide.emplace_back(rootMoves[i], rootNodes[i]);
+            }
+        }
+    } else {
+        res.nodes = 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    res.durationMicros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return res;
+}
+
+uint64_t PerftResult::nodesPerSecond() const {
+    return durationMicros > 0 ? nodes * 1000000 / durationMicros : 0;
+}
+
+std::ostream& operator<<(std::ostream &os, const PerftResult &res) {
+    for (const auto &entry : res.divide) {
+        os << entry.first << ": " << entry.second << '\n';
+    }
+    return os << "nodes: " << res.nodes << " timeMillis: " << res.durationMicros / 1000 << " nps: " << res.nodesPerSecond();
+}
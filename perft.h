@@ -0,0 +1,42 @@
+#ifndef CHESS_PERFT_H
+#define CHESS_PERFT_H
+
+#include <atomic>
+#include <memory>
+
+#include "chess.h"
+
+// Shared (hash, depth) -> node count table. Each entry stores the key xor'd with its data, so a
+// torn write from another thread fails the key check instead of returning a wrong count.
+class PerftHash {
+public:
+    explicit PerftHash(size_t megabytes);
+
+    bool probe(uint64_t hash, int depth, uint64_t &nodes) const;
+    void store(uint64_t hash, int depth, uint64_t nodes);
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> keyXorData;
+        std::atomic<uint64_t> data;
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    uint64_t mask = 0;
+};
+
+struct PerftResult {
+    uint64_t nodes = 0;
+    long durationMicros = 0;
+    std::vector<std::pair<Move, uint64_t>> divide;
+
+    uint64_t nodesPerSecond() const;
+};
+
+uint64_t perft(Board &b, int depth);
+uint64_t perft(Board &b, int depth, PerftHash &hash);
+PerftResult runPerft(Board &b, int depth, bool divide, int threads = 1, PerftHash *hash = nullptr);
+
+std::ostream& operator<<(std::ostream &os, const PerftResult &res);
+
+#endif //CHESS_PERFT_H
@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "retrograde.h"
+
+// Indices handed to a thread at a time.
+const uint64_t GENERATION_CHUNK = 4096;
+// Four identical pieces, times the reflection in the diagonal.
+const int MAX_EQUIVALENT_INDICES = 48;
+// The longest mate an entry can store, see tablebase.h.
+const int MAX_TABLEBASE_DTM = TB_INVALID - TB_LOSS - 1;
+
+const int KING_STEPS[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+const int KNIGHT_STEPS[8][2] = {{2, 1}, {1, 2}, {-1, 2}, {-2, 1}, {-2, -1}, {-1, -2}, {1, -2}, {2, -1}};
+
+// One bit per index, set from several threads at once.
+class AtomicBitSet {
+public:
+    explicit AtomicBitSet(uint64_t size) : wordCount((size + 63) / 64), words(new std::atomic<uint64_t>[wordCount]) {
+        clear();
+    }
+
+    void set(uint64_t i) { words[i / 64].fetch_or(1lu << (i % 64), std::memory_order_relaxed); }
+    bool test(uint64_t i) const { return (words[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1lu; }
+
+    void clear() {
+        for (uint64_t i = 0; i < wordCount; i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    uint64_t wordCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+};
+
+struct TableLayout {
+    std::string name;
+    int pieces = 0;
+    int strongPieces = 0;
+    bool hasPawns = false;
+    uint8_t types[TB_MAX_PIECES];
+    uint64_t size = 0;
+
+    explicit TableLayout(const std::string &name) : name(name) {
+        for (char c : name) {
+            if (c == 'v') {
+                strongPieces = pieces;
+            } else {
+                types[pieces++] = pieceTypeFromChar(std::tolower(c));
+            }
+        }
+        hasPawns = name.find('P') != std::string::npos;
+        size = tablebaseSize(pieces, hasPawns);
+    }
+};
+
+// A position is decided in the pass equal to its distance to mate: a win once a move reaches a
+// loss decided in the pass before, a loss once every move reaches a decided win. Only positions
+// with a move into what the last pass decided, found by unmaking moves, are looked at again, and
+// moves leaving the table are read from the smaller tables. What is never decided is a draw.
+struct Generation {
+    const TableLayout &t;
+    // The table itself, a byte per index, see retrograde.h.
+    std::vector<uint8_t> entries;
+    // The smallest of each position's indices, the only one searched, see equivalentIndices.
+    AtomicBitSet representative;
+    AtomicBitSet decided;
+    AtomicBitSet candidates;
+    // The pass where a move out of the table decides the position, or 0.
+    std::vector<uint8_t> exitPass;
+    std::atomic<uint64_t> positionsSearched{0};
+    std::atomic<uint64_t> movesMade{0};
+    // Set when a capture or promotion leads to a position no loaded table answers for.
+    std::atomic<bool> exitUnknown{false};
+
+    explicit Generation(const TableLayout &t) : t(t), entries(t.size, TB_INVALID),
+            representative(t.size), decided(t.size), candidates(t.size), exitPass(t.size, 0) {}
+};
+
+template<typename Work>
+void forEachChunk(uint64_t size, int threads, Work work) {
+    std::atomic<uint64_t> next(0);
+    auto run = [&](int thread) {
+        for (uint64_t begin = next.fetch_add(GENERATION_CHUNK); begin < size; begin = next.fetch_add(GENERATION_CHUNK)) {
+            work(thread, begin, std::min(begin + GENERATION_CHUNK, size));
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(run, t);
+    }
+    run(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+// False when the squares aren't a legal position: two pieces on a square, a pawn on the first or
+// last rank, or the side not to move in check.
+bool layoutBoard(const TableLayout &t, const int *squares, bool strongToMove, Board &b) {
+    uint64_t occupied = 0;
+    PieceList strong;
+    PieceList weak;
+    for (int i = 0; i < t.pieces; i++) {
+        int sq = squares[i];
+        if (getNthBit(occupied, sq) || (t.types[i] == PAWN && (sq < 8 || sq >= 56))) {
+            return false;
+        }
+        setNthBit(occupied, sq);
+        (i < t.strongPieces ? strong : weak).push_back(PieceElement(t.types[i], sqRank(sq), sqFile(sq)));
+    }
+    b = Board(strong, weak, strongToMove);
+    return !inCheck(b, !b.whiteToMove);
+}
+
+void addPermutations(const TableLayout &t, int *squares, int start, bool strongToMove, uint64_t *indices, int &count) {
+    if (start == t.pieces) {
+        int copy[TB_MAX_PIECES];
+        std::copy(squares, squares + t.pieces, copy);
+        indices[count++] = tablebaseIndex(copy, t.pieces, strongToMove, t.hasPawns);
+        return;
+    }
+    int end = start + 1;
+    while (end < t.pieces && end != t.strongPieces && t.types[end] == t.types[start]) {
+        end++;
+    }
+    std::sort(squares + start, squares + end);
+    do {
+        addPermutations(t, squares, end, strongToMove, indices, count);
+    } while (std::next_permutation(squares + start, squares + end));
+}
+
+// Every index storing the position: identical pieces go in any order, and without pawns a king on
+// the a1-h8 diagonal leaves both the board and its reflection in that diagonal.
+int equivalentIndices(const TableLayout &t, const int *squares, bool strongToMove, uint64_t *indices) {
+    int canonical[TB_MAX_PIECES];
+    std::copy(squares, squares + t.pieces, canonical);
+    tablebaseIndex(canonical, t.pieces, strongToMove, t.hasPawns);
+    int count = 0;
+    addPermutations(t, canonical, 1, strongToMove, indices, count);
+    if (!t.hasPawns && canonical[0] / 8 == canonical[0] % 8) {
+        for (int i = 0; i < t.pieces; i++) {
+            canonical[i] = (canonical[i] % 8) * 8 + canonical[i] / 8;
+        }
+        addPermutations(t, canonical, 1, strongToMove, indices, count);
+    }
+    return count;
+}
+
+uint64_t representativeIndex(const TableLayout &t, const int *squares, bool strongToMove) {
+    uint64_t indices[MAX_EQUIVALENT_INDICES];
+    int count = equivalentIndices(t, squares, strongToMove, indices);
+    return *std::min_element(indices, indices + count);
+}
+
+// Searches b one ply deep against what the passes before this one decided. Returns the entry, or
+// TB_INVALID while undecided. In pass 0 only checkmate is decided, and exitPass is filled in.
+uint8_t searchPosition(Generation &g, Board &b, int pass, uint64_t idx) {
+    BoardContext bc(b);
+    MoveList moves = getMoves(b, bc);
+    g.positionsSearched.fetch_add(1, std::memory_order_relaxed);
+    g.movesMade.fetch_add(moves.size(), std::memory_order_relaxed);
+    if (moves.empty()) {
+        return pass == 0 && bc.checkers ? TB_LOSS : TB_INVALID;
+    }
+
+    int fastestLoss = -1;
+    int slowestWin = -1;
+    bool allWins = true;
+    int fastestExitLoss = -1;
+    int slowestExitWin = -1;
+    bool allExitsWin = true;
+    for (const Move &m : moves) {
+        Board child = b;
+        child.doMove(m);
+        TablebaseResult res;
+        bool exit = m.captureType != EMPTY || m.promoteType;
+        if (exit) {
+            if (!probeTablebase(child, res)) {
+                g.exitUnknown.store(true, std::memory_order_relaxed);
+                return TB_INVALID;
+            }
+            if (res.wdl < 0 && (fastestExitLoss < 0 || res.dtm < fastestExitLoss)) {
+                fastestExitLoss = res.dtm;
+            }
+            if (res.wdl > 0) {
+                slowestExitWin = std::max(slowestExitWin, res.dtm);
+            } else {
+                allExitsWin = false;
+            }
+        } else {
+            uint64_t childIdx = tablebaseIndex(child, false, g.t.hasPawns);
+            if (!g.decided.test(childIdx)) {
+                allWins = false;
+                continue;
+            }
+            res = decodeTablebaseEntry(g.entries[childIdx]);
+        }
+        if (res.wdl < 0 && res.dtm < pass && (fastestLoss < 0 || res.dtm < fastestLoss)) {
+            fastestLoss = res.dtm;
+        }
+        if (res.wdl > 0 && res.dtm < pass) {
+            slowestWin = std::max(slowestWin, res.dtm);
+        } else {
+            allWins = false;
+        }
+    }
+
+    if (pass == 0) {
+        g.exitPass[idx] = fastestExitLoss >= 0 ? fastestExitLoss + 1 : (allExitsWin && slowestExitWin >= 0 ? slowestExitWin + 1 : 0);
+        return TB_INVALID;
+    }
+    if (fastestLoss >= 0) {
+        return fastestLoss + 1;
+    }
+    return allWins ? TB_LOSS + slowestWin + 1 : TB_INVALID;
+}
+
+// Marks the positions one move before, with the other side to move. Captures and promotions lead
+// here from other tables, so only quiet moves are unmade.
+void markPredecessors(Generation &g, const int *squares, bool strongToMove) {
+    const TableLayout &t = g.t;
+    uint64_t occupied = 0;
+    for (int i = 0; i < t.pieces; i++) {
+        setNthBit(occupied, squares[i]);
+    }
+    int predecessor[TB_MAX_PIECES];
+    auto mark = [&](int i, int origin) {
+        std::copy(squares, squares + t.pieces, predecessor);
+        predecessor[i] = origin;
+        uint64_t idx = representativeIndex(t, predecessor, !strongToMove);
+        if (g.representative.test(idx) && !g.decided.test(idx)) {
+            g.candidates.set(idx);
+        }
+    };
+
+    int first = strongToMove ? t.strongPieces : 0;
+    int last = strongToMove ? t.pieces : t.strongPieces;
+    for (int i = first; i < last; i++) {
+        int sq = squares[i];
+        int rank = sq / 8;
+        int file = sq % 8;
+        uint8_t pieceType = t.types[i];
+        if (pieceType == PAWN) {
+            // The stronger side plays white, up the board.
+            int back = i < t.strongPieces ? -1 : 1;
+            int startRank = i < t.strongPieces ? 1 : 6;
+            int origin = sq + back * 8;
+            if (rank + back < 1 || rank + back > 6 || getNthBit(occupied, origin)) {
+                continue;
+            }
+            mark(i, origin);
+            if (rank + 2 * back == startRank && !getNthBit(occupied, origin + back * 8)) {
+                mark(i, origin + back * 8);
+            }
+            continue;
+        }
+        if (pieceType == KING || pieceType == KNIGHT) {
+            const int (*steps)[2] = pieceType == KING ? KING_STEPS : KNIGHT_STEPS;
+            for (int s = 0; s < 8; s++) {
+                int r = rank + steps[s][0];
+                int f = file + steps[s][1];
+                if (r >= 0 && r < 8 && f >= 0 && f < 8 && !getNthBit(occupied, r * 8 + f)) {
+                    mark(i, r * 8 + f);
+                }
+            }
+            continue;
+        }
+        for (int s = 0; s < 8; s++) {
+            bool diagonal = s % 2 == 1;
+            if ((pieceType == ROOK && diagonal) || (pieceType == BISHOP && !diagonal)) {
+                continue;
+            }
+            for (int r = rank + KING_STEPS[s][0], f = file + KING_STEPS[s][1];
+                    r >= 0 && r < 8 && f >= 0 && f < 8 && !getNthBit(occupied, r * 8 + f);
+                    r += KING_STEPS[s][0], f += KING_STEPS[s][1]) {
+                mark(i, r * 8 + f);
+            }
+        }
+    }
+}
+
+bool solveTablebase(const TableLayout &t, int threads, GenerationResult &res) {
+    auto start = std::chrono::steady_clock::now();
+    Generation g(t);
+    std::vector<std::vector<std::pair<uint64_t, uint8_t>>> decisions(threads);
+    std::atomic<int> lastExitPass(0);
+
+    for (int pass = 0; ; pass++) {
+        for (auto &threadDecisions : decisions) {
+            threadDecisions.clear();
+        }
+        forEachChunk(t.size, threads, [&](int thread, uint64_t begin, uint64_t end) {
+            int squares[TB_MAX_PIECES];
+            bool strongToMove;
+            Board b;
+            int exitPassSeen = 0;
+            for (uint64_t idx = begin; idx < end; idx++) {
+                if (pass == 0) {
+                    tablebaseSquares(idx, t.pieces, t.hasPawns, squares, strongToMove);
+                    if (!layoutBoard(t, squares, strongToMove, b)) {
+                        continue;
+                    }
+                    g.entries[idx] = TB_DRAW;
+                    if (representativeIndex(t, squares, strongToMove) != idx) {
+                        continue;
+                    }
+                    g.representative.set(idx);
+                } else if (g.decided.test(idx) || (!g.candidates.test(idx) && g.exitPass[idx] != pass)) {
+                    continue;
+                } else {
+                    tablebaseSquares(idx, t.pieces, t.hasPawns, squares, strongToMove);
+                    layoutBoard(t, squares, strongToMove, b);
+                }
+                uint8_t entry = searchPosition(g, b, pass, idx);
+                if (entry != TB_INVALID) {
+                    decisions[thread].emplace_back(idx, entry);
+                }
+                exitPassSeen = std::max<int>(exitPassSeen, g.exitPass[idx]);
+            }
+            for (int seen = lastExitPass.load(); seen < exitPassSeen && !lastExitPass.compare_exchange_weak(seen, exitPassSeen); ) {
+            }
+        });
+        if (g.exitUnknown) {
+            return false;
+        }
+
+        std::vector<std::pair<uint64_t, uint8_t>> decided;
+        for (auto &threadDecisions : decisions) {
+            decided.insert(decided.end(), threadDecisions.begin(), threadDecisions.end());
+        }
+        if (decided.empty() && pass >= lastExitPass) {
+            res.passes = pass;
+            break;
+        }
+        if (pass >= MAX_TABLEBASE_DTM) {
+            return false;
+        }
+
+        g.candidates.clear();
+        forEachChunk(decided.size(), threads, [&](int, uint64_t begin, uint64_t end) {
+            int squares[TB_MAX_PIECES];
+            bool strongToMove;
+            uint64_t indices[MAX_EQUIVALENT_INDICES];
+            for (uint64_t i = begin; i < end; i++) {
+                tablebaseSquares(decided[i].first, t.pieces, t.hasPawns, squares, strongToMove);
+                int count = equivalentIndices(t, squares, strongToMove, indices);
+                for (int j = 0; j < count; j++) {
+                    g.entries[indices[j]] = decided[i].second;
+                    g.decided.set(indices[j]);
+                }
+                markPredecessors(g, squares, strongToMove);
+            }
+        });
+    }
+
+    res.name = t.name;
+    for (uint8_t entry : g.entries) {
+        if (entry == TB_INVALID) {
+            continue;
+        }
+        TablebaseResult r = decodeTablebaseEntry(entry);
+        res.positions++;
+        (r.wdl > 0 ? res.wins : (r.wdl < 0 ? res.losses : res.draws))++;
+        res.maxDtm = std::max(res.maxDtm, r.dtm);
+    }
+    res.positionsSearched = g.positionsSearched;
+    res.movesMade = g.movesMade;
+    addTablebase(t.name, std::move(g.entries));
+    res.durationMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// The tables reached by a capture or a promotion, bare kings aside.
+std::vector<std::string> conversionTablebases(const std::string &name) {
+    std::vector<std::string> res;
+    auto add = [&](const std::string &converted) {
+        std::string canonical = canonicalTablebaseName(converted);
+        if (canonical.size() > 3 && std::find(res.begin(), res.end(), canonical) == res.end()) {
+            res.push_back(canonical);
+        }
+    };
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] == 'v' || name[i] == 'K') {
+            continue;
+        }
+        add(name.substr(0, i) + name.substr(i + 1));
+        if (name[i] == 'P') {
+            for (char promoted : std::string("QRBN")) {
+                std::string converted = name;
+                converted[i] = promoted;
+                add(converted);
+            }
+        }
+    }
+    return res;
+}
+
+bool generateTablebase(const std::string &name, int threads, std::vector<GenerationResult> &results) {
+    std::string canonical = canonicalTablebaseName(name);
+    if (canonical.empty() || (int)canonical.size() - 1 > TB_MAX_PIECES) {
+        return false;
+    }
+    if (canonical.size() <= 3 || hasTablebase(canonical)) {
+        return true;
+    }
+    for (const std::string &converted : conversionTablebases(canonical)) {
+        if (!generateTablebase(converted, threads, results)) {
+            return false;
+        }
+    }
+    GenerationResult res;
+    if (!solveTablebase(TableLayout(canonical), std::max(threads, 1), res)) {
+        return false;
+    }
+    results.push_back(res);
+    return true;
+}
+
+void addPieceSets(int count, size_t first, std::string &current, std::vector<std::string> &sets) {
+    if (count == 0) {
+        sets.push_back(current);
+        return;
+    }
+    const std::string pieces = "QRBNP";
+    for (size_t i = first; i < pieces.size(); i++) {
+        current.push_back(pieces[i]);
+        addPieceSets(count - 1, i, current, sets);
+        current.pop_back();
+    }
+}
+
+std::vector<std::string> tablebaseNames(int pieces) {
+    std::vector<std::string> names;
+    for (int n = 3; n <= std::min(pieces, TB_MAX_PIECES); n++) {
+        for (int strongCount = n - 2; strongCount >= 0; strongCount--) {
+            std::vector<std::string> strongSets;
+            std::vector<std::string> weakSets;
+            std::string current;
+            addPieceSets(strongCount, 0, current, strongSets);
+            addPieceSets(n - 2 - strongCount, 0, current, weakSets);
+            for (const std::string &strong : strongSets) {
+                for (const std::string &weak : weakSets) {
+                    std::string name = canonicalTablebaseName("K" + strong + "vK" + weak);
+                    if (std::find(names.begin(), names.end(), name) == names.end()) {
+                        names.push_back(name);
+                    }
+                }
+            }
+        }
+    }
+    return names;
+}
+
+std::ostream& operator<<(std::ostream &os, const GenerationResult &res) {
+    uint64_t movesPerSecond = res.durationMicros > 0 ? res.movesMade * 1000000 / res.durationMicros : 0;
+    return os << res.name << " positions: " << res.positions << " wins: " << res.wins << " draws: " << res.draws
+              << " losses: " << res.losses << " maxDtm: " << res.maxDtm << " passes: " << res.passes
+              << " searched: " << res.positionsSearched << " moves: " << res.movesMade
+              << " timeMillis: " << res.durationMicros / 1000 << " movesPerSecond: " << movesPerSecond;
+}
@@ -0,0 +1,44 @@
+#ifndef CHESS_RETROGRADE_H
+#define CHESS_RETROGRADE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "tablebase.h"
+
+struct GenerationResult {
+    std::string name;
+    // Legal positions, counting each index that stores one.
+    uint64_t positions = 0;
+    uint64_t wins = 0;
+    uint64_t draws = 0;
+    uint64_t losses = 0;
+    int maxDtm = 0;
+    int passes = 0;
+    // Positions given to getMoves and the moves made from them, the generator's load on movegen.
+    uint64_t positionsSearched = 0;
+    uint64_t movesMade = 0;
+    long durationMicros = 0;
+};
+
+// A table is built in the layout it is probed in: one entry byte per tablebaseIndex, TB_INVALID where
+// the index isn't a legal position. The solved entries go to addTablebase and saveTablebase as they
+// are, and a probe stays a single load at a computed offset. Packing wouldn't shrink an entry, since
+// a distance to mate up to 127 plus a loss flag takes the whole byte. Indexing only legal placements
+// would save the unused indices, about a third (KQvK uses 57557 of 81920, KPvK 165676 of 262144),
+// but then every probe and every predecessor lookup would need a rank over a bitmap. The solver's
+// other per-index state is three bits and one byte.
+
+// Solves a table by retrograde analysis, with Board and getMoves as the rules, and adds it to the
+// loaded tables. The tables its captures and promotions lead into come first, generated here unless
+// already loaded, and each table generated is appended to results. False for a name that doesn't
+// parse, a table whose mates are too long for its entries, or one whose captures and promotions
+// reach positions the tables they lead into don't answer.
+bool generateTablebase(const std::string &name, int threads, std::vector<GenerationResult> &results);
+// Every table with 3 up to pieces pieces, fewest first.
+std::vector<std::string> tablebaseNames(int pieces);
+
+std::ostream& operator<<(std::ostream &os, const GenerationResult &res);
+
+#endif //CHESS_RETROGRADE_H
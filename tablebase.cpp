@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tablebase.h"
+
+const char TB_MAGIC[] = "CHSTB001";
+
+struct Tablebase {
+    const uint8_t *data;
+    size_t size;
+    bool hasPawns;
+    // A generated table's header and entries, which data points into. Empty for a mapped file.
+    std::vector<uint8_t> memory;
+};
+
+// Keyed by the stronger side's material in the high bits and the other side's in the low ones, see
+// sideMaterial.
+std::unordered_map<uint64_t, Tablebase> tablebases;
+int maxTablebasePieces = 0;
+
+const int8_t KING_TRIANGLE[64] = {
+        0,  1,  2,  3, -1, -1, -1, -1,
+       -1,  4,  5,  6, -1, -1, -1, -1,
+       -1, -1,  7,  8, -1, -1, -1, -1,
+       -1, -1, -1,  9, -1, -1, -1, -1,
+       -1, -1, -1, -1, -1, -1, -1, -1,
+       -1, -1, -1, -1, -1, -1, -1, -1,
+       -1, -1, -1, -1, -1, -1, -1, -1,
+       -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// Four bits counting each piece type.
+uint64_t sideMaterial(const PieceList &pieces) {
+    uint64_t material = 0;
+    for (const PieceElement &pe : pieces) {
+        material += 1lu << (4u * (pe.pieceType - KING));
+    }
+    return material;
+}
+
+int materialStrength(uint64_t material) {
+    int strength = 0;
+    for (uint8_t pieceType = KING; pieceType <= PAWN; pieceType++) {
+        strength += ((material >> (4u * (pieceType - KING))) & 0xFu) * getPieceScore(pieceType);
+    }
+    return strength;
+}
+
+bool materialIsStronger(uint64_t material, uint64_t other) {
+    int strength = materialStrength(material);
+    int otherStrength = materialStrength(other);
+    return strength != otherStrength ? strength > otherStrength : material > other;
+}
+
+bool blackIsStronger(const Board &b) {
+    return materialIsStronger(sideMaterial(b.blackPieces), sideMaterial(b.whitePieces));
+}
+
+std::string materialName(uint64_t material) {
+    std::string name;
+    for (uint8_t pieceType = KING; pieceType <= PAWN; pieceType++) {
+        name.append((material >> (4u * (pieceType - KING))) & 0xFu, std::toupper(pieceTypeToChar(pieceType)));
+    }
+    return name;
+}
+
+bool materialFromName(const std::string &name, uint64_t &material) {
+    material = 0;
+    for (char c : name) {
+        uint8_t pieceType = pieceTypeFromChar(std::tolower(c));
+        if (pieceType < KING || pieceType > PAWN) {
+            return false;
+        }
+        material += 1lu << (4u * (pieceType - KING));
+    }
+    return true;
+}
+
+// Each side needs its one king, counted in the low four bits.
+bool materialFromTablebaseName(const std::string &name, uint64_t &strong, uint64_t &weak) {
+    size_t split = name.find('v');
+    return split != std::string::npos && materialFromName(name.substr(0, split), strong) &&
+           materialFromName(name.substr(split + 1), weak) && (strong & 0xFu) == 1 && (weak & 0xFu) == 1;
+}
+
+std::string tablebaseName(const Board &b, bool &flip) {
+    flip = blackIsStronger(b);
+    const PieceList &strong = flip ? b.blackPieces : b.whitePieces;
+    const PieceList &weak = flip ? b.whitePieces : b.blackPieces;
+    return materialName(sideMaterial(strong)) + "v" + materialName(sideMaterial(weak));
+}
+
+std::string canonicalTablebaseName(const std::string &name) {
+    uint64_t strong;
+    uint64_t weak;
+    if (!materialFromTablebaseName(name, strong, weak)) {
+        return "";
+    }
+    if (materialIsStronger(weak, strong)) {
+        std::swap(strong, weak);
+    }
+    return materialName(strong) + "v" + materialName(weak);
+}
+
+uint64_t tablebaseSize(int pieces, bool hasPawns) {
+    uint64_t size = 2 * (hasPawns ? TB_PAWN_KING_SQUARES : TB_KING_SQUARES);
+    for (int i = 1; i < pieces; i++) {
+        size *= 64;
+    }
+    return size;
+}
+
+int appendSquares(const PieceList &pieces, bool flip, int *squares, int n) {
+    for (uint8_t pieceType = KING; pieceType <= PAWN; pieceType++) {
+        for (const PieceElement &pe : pieces) {
+            if (pe.pieceType == pieceType) {
+                squares[n++] = getBitIdx(pe.rank, pe.file) ^ (flip ? 56 : 0);
+            }
+        }
+    }
+    return n;
+}
+
+uint64_t tablebaseIndex(const Board &b, bool flip, bool hasPawns) {
+    int squares[TB_MAX_PIECES];
+    int n = appendSquares(flip ? b.blackPieces : b.whitePieces, flip, squares, 0);
+    n = appendSquares(flip ? b.whitePieces : b.blackPieces, flip, squares, n);
+    return tablebaseIndex(squares, n, b.whiteToMove != flip, hasPawns);
+}
+
+uint64_t tablebaseIndex(int *squares, int n, bool strongToMove, bool hasPawns) {
+    int king = squares[0];
+    bool mirrorFile = king % 8 > 3;
+    bool mirrorRank = !hasPawns && king / 8 > 3;
+    int kingFile = mirrorFile ? 7 - king % 8 : king % 8;
+    int kingRank = mirrorRank ? 7 - king / 8 : king / 8;
+    bool transpose = !hasPawns && kingRank > kingFile;
+    for (int i = 0; i < n; i++) {
+        int sq = squares[i] ^ (mirrorFile ? 7 : 0) ^ (mirrorRank ? 56 : 0);
+        squares[i] = transpose ? (sq % 8) * 8 + sq / 8 : sq;
+    }
+
+    uint64_t kingSquares = hasPawns ? TB_PAWN_KING_SQUARES : TB_KING_SQUARES;
+    uint64_t kingIdx = hasPawns ? (squares[0] / 8) * 4 + squares[0] % 8 : KING_TRIANGLE[squares[0]];
+    uint64_t index = (strongToMove ? 0 : kingSquares) + kingIdx;
+    for (int i = 1; i < n; i++) {
+        index = index * 64 + squares[i];
+    }
+    return index;
+}
+
+void tablebaseSquares(uint64_t index, int n, bool hasPawns, int *squares, bool &strongToMove) {
+    for (int i = n - 1; i >= 1; i--) {
+        squares[i] = index % 64;
+        index /= 64;
+    }
+    uint64_t kingSquares = hasPawns ? TB_PAWN_KING_SQUARES : TB_KING_SQUARES;
+    strongToMove = index < kingSquares;
+    uint64_t kingIdx = index % kingSquares;
+    if (hasPawns) {
+        squares[0] = (kingIdx / 4) * 8 + kingIdx % 4;
+    } else {
+        squares[0] = std::find(KING_TRIANGLE, KING_TRIANGLE + 64, kingIdx) - KING_TRIANGLE;
+    }
+}
+
+TablebaseResult decodeTablebaseEntry(uint8_t entry) {
+    if (entry == TB_DRAW) {
+        return {0, 0};
+    }
+    return entry < TB_LOSS ? TablebaseResult{1, entry} : TablebaseResult{-1, entry - TB_LOSS};
+}
+
+void unloadTablebases() {
+    for (auto &entry : tablebases) {
+        if (entry.second.memory.empty()) {
+            munmap(const_cast<uint8_t*>(entry.second.data), entry.second.size);
+        }
+    }
+    tablebases.clear();
+    maxTablebasePieces = 0;
+}
+
+void removeTablebase(uint64_t key) {
+    auto it = tablebases.find(key);
+    if (it == tablebases.end()) {
+        return;
+    }
+    if (it->second.memory.empty()) {
+        munmap(const_cast<uint8_t*>(it->second.data), it->second.size);
+    }
+    tablebases.erase(it);
+}
+
+bool mapTablebase(const std::string &path, const std::string &name) {
+    uint64_t strong;
+    uint64_t weak;
+    if (!materialFromTablebaseName(name, strong, weak)) {
+        return false;
+    }
+    int pieces = name.size() - 1;
+    bool hasPawns = name.find('P') != std::string::npos;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pieces > TB_MAX_PIECES || (uint64_t)st.st_size != TB_HEADER_SIZE + tablebaseSize(pieces, hasPawns)) {
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    const uint8_t *data = static_cast<const uint8_t*>(mapping);
+    uint32_t headerPieces;
+    std::memcpy(&headerPieces, data + 8, sizeof(headerPieces));
+    if (std::memcmp(data, TB_MAGIC, 8) != 0 || headerPieces != (uint32_t)pieces) {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    removeTablebase((strong << 24u) | weak);
+    tablebases[(strong << 24u) | weak] = Tablebase{data, (size_t)st.st_size, hasPawns, {}};
+    maxTablebasePieces = std::max(maxTablebasePieces, pieces);
+    return true;
+}
+
+int loadTablebases(const std::string &directory) {
+    unloadTablebases();
+    std::error_code error;
+    for (const auto &file : std::filesystem::directory_iterator(directory, error)) {
+        if (file.path().extension() == ".tb") {
+            mapTablebase(file.path().string(), file.path().stem().string());
+        }
+    }
+    return tablebases.size();
+}
+
+void addTablebase(const std::string &name, std::vector<uint8_t> entries) {
+    uint64_t strong;
+    uint64_t weak;
+    if (!materialFromTablebaseName(name, strong, weak)) {
+        return;
+    }
+    int pieces = name.size() - 1;
+    uint32_t headerPieces = pieces;
+    std::vector<uint8_t> memory(TB_HEADER_SIZE, 0);
+    std::memcpy(memory.data(), TB_MAGIC, 8);
+    std::memcpy(memory.data() + 8, &headerPieces, sizeof(headerPieces));
+    memory.insert(memory.end(), entries.begin(), entries.end());
+
+    removeTablebase((strong << 24u) | weak);
+    Tablebase &tb = tablebases[(strong << 24u) | weak];
+    tb.memory = std::move(memory);
+    tb.data = tb.memory.data();
+    tb.size = tb.memory.size();
+    tb.hasPawns = name.find('P') != std::string::npos;
+    maxTablebasePieces = std::max(maxTablebasePieces, pieces);
+}
+
+bool hasTablebase(const std::string &name) {
+    uint64_t strong;
+    uint64_t weak;
+    return materialFromTablebaseName(name, strong, weak) && tablebases.count((strong << 24u) | weak);
+}
+
+bool saveTablebase(const std::string &name, const std::string &directory) {
+    uint64_t strong;
+    uint64_t weak;
+    if (!materialFromTablebaseName(name, strong, weak) || !tablebases.count((strong << 24u) | weak)) {
+        return false;
+    }
+    const Tablebase &tb = tablebases[(strong << 24u) | weak];
+    std::ofstream out(directory + "/" + name + ".tb", std::ios::binary);
+    return (bool)out.write(reinterpret_cast<const char*>(tb.data), tb.size);
+}
+
+int tablebasePieces() {
+    return maxTablebasePieces;
+}
+
+// Bare kings are a draw without a table.
+bool probeTablebase(const Board &b, TablebaseResult &res) {
+    int pieces = b.whitePieces.size() + b.blackPieces.size();
+    if (pieces == 2) {
+        res = {0, 0};
+        return true;
+    }
+    if (pieces > maxTablebasePieces) {
+        return false;
+    }
+    bool flip = blackIsStronger(b);
+    uint64_t strong = sideMaterial(flip ? b.blackPieces : b.whitePieces);
+    uint64_t weak = sideMaterial(flip ? b.whitePieces : b.blackPieces);
+    auto it = tablebases.find((strong << 24u) | weak);
+    if (it == tablebases.end()) {
+        return false;
+    }
+    uint8_t entry = it->second.data[TB_HEADER_SIZE + tablebaseIndex(b, flip, it->second.hasPawns)];
+    if (entry == TB_INVALID) {
+        return false;
+    }
+    res = decodeTablebaseEntry(entry);
+    return true;
+}
+
+// Each move is scored from the result it leaves the opponent with.
+bool probeTablebaseRoot(Board &b, Move &move, TablebaseResult &res) {
+    if (b.whitePieces.size() + b.blackPieces.size() > maxTablebasePieces) {
+        return false;
+    }
+    BoardContext bc(b);
+    MoveList moves = getMoves(b, bc);
+    bool found = false;
+    int bestScore = 0;
+    for (const Move &m : moves) {
+        b.doMove(m);
+        BoardContext childBc(b);
+        TablebaseResult child;
+        bool known = true;
+        if (getMoves(b, childBc).empty()) {
+            child = {childBc.checkers ? -1 : 0, 0};
+        } else {
+            known = probeTablebase(b, child);
+        }
+        b.undoMove(m);
+        if (!known) {
+            return false;
+        }
+
+        int dtm = child.wdl == 0 ? 0 : 1 + child.dtm;
+        int score = child.wdl < 0 ? TB_LOSS - dtm : (child.wdl > 0 ? dtm - TB_LOSS : 0);
+        if (!found || score > bestScore) {
+            found = true;
+            bestScore = score;
+            move = m;
+            res = {-child.wdl, dtm};
+        }
+    }
+    return found;
+}
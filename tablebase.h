@@ -0,0 +1,76 @@
+#ifndef CHESS_TABLEBASE_H
+#define CHESS_TABLEBASE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chess.h"
+
+// Endgame tables in this engine's own format, one file per material balance, named after it with
+// the stronger side first, like KQvKR.tb. retrograde.h generates them. A 16 byte header (the magic
+// "CHSTB001", then the piece count and a reserved word as little-endian uint32) is followed by one
+// distance to mate byte per position.
+//
+// Positions are indexed by the side to move and the squares of the stronger side's pieces, then the
+// other side's, each side in the order K, Q, R, B, N, P. The board is first turned so the stronger
+// side is white, then mirrored so its king is on files a-d, and without pawns also on a1-d1-d4, so
+// that king takes only 32 or 10 values. Identical pieces are stored in every order.
+const int TB_HEADER_SIZE = 16;
+const int TB_MAX_PIECES = 6;
+const int TB_PAWN_KING_SQUARES = 32;
+const int TB_KING_SQUARES = 10;
+
+// A win stores its distance to mate in plies, 1..127. A loss stores TB_LOSS plus the plies until
+// mate, TB_LOSS itself being checkmate. There is no fifty move rule, so the distance only serves to
+// make progress.
+const uint8_t TB_DRAW = 0;
+const uint8_t TB_LOSS = 128;
+const uint8_t TB_INVALID = 255;
+
+// For a win whose mate lies beyond MAX_PLY from the root: below every mate value, above any
+// evaluation.
+const int TB_WIN_VALUE = CHECKMATE_VALUE - 2 * MAX_PLY;
+
+// wdl is 1, 0 or -1 for the side to move.
+struct TablebaseResult {
+    int wdl = 0;
+    int dtm = 0;
+};
+
+// Maps every .tb file in directory, replacing the tables loaded or generated before. Returns the
+// number loaded.
+int loadTablebases(const std::string &directory);
+// Adds a table held in memory, one entry per index, replacing any loaded under the same name.
+void addTablebase(const std::string &name, std::vector<uint8_t> entries);
+bool hasTablebase(const std::string &name);
+bool saveTablebase(const std::string &name, const std::string &directory);
+// The most pieces of any loaded table, 0 without tables.
+int tablebasePieces();
+bool probeTablebase(const Board &b, TablebaseResult &res);
+// The move keeping the best result: the fastest mate in a win, the slowest in a loss.
+bool probeTablebaseRoot(Board &b, Move &move, TablebaseResult &res);
+
+// Shared with the generator. flip is set when black is the stronger side.
+std::string tablebaseName(const Board &b, bool &flip);
+// The name with the stronger side first and each side's pieces in index order, or empty when it
+// doesn't name two sides with a king each.
+std::string canonicalTablebaseName(const std::string &name);
+uint64_t tablebaseSize(int pieces, bool hasPawns);
+uint64_t tablebaseIndex(const Board &b, bool flip, bool hasPawns);
+// The same for squares in index order, with the stronger side as white. Mirrors them in place.
+uint64_t tablebaseIndex(int *squares, int pieces, bool strongToMove, bool hasPawns);
+// The inverse, which doesn't check that the squares make a legal position.
+void tablebaseSquares(uint64_t index, int pieces, bool hasPawns, int *squares, bool &strongToMove);
+TablebaseResult decodeTablebaseEntry(uint8_t entry);
+
+// A win or loss scores as the mate it leads to, ply + dtm plies from the root.
+inline int tablebaseValue(const TablebaseResult &tb, int ply) {
+    if (tb.wdl == 0) {
+        return 0;
+    }
+    int value = ply + tb.dtm <= MAX_PLY ? CHECKMATE_VALUE - ply - tb.dtm : TB_WIN_VALUE - ply;
+    return tb.wdl > 0 ? value : -value;
+}
+
+#endif //CHESS_TABLEBASE_H
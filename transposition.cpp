@@ -0,0 +1,96 @@
+#include "transposition.h"
+
+// An entry packs into one 64-bit word: value in the low 32 bits, then move, depth, and the bound in
+// the top byte's low two bits under the generation it was stored in. An entry from another
+// generation unpacks with BOUND_NONE, like an empty slot.
+uint64_t packEntry(const TTEntry &e, uint8_t generation) {
+    auto value = (uint32_t)e.value;
+    uint64_t boundByte = e.bound | (generation << 2u);
+    return value | ((uint64_t)e.move << 32u) | ((uint64_t)e.depth << 48u) | (boundByte << 56u);
+}
+
+TTEntry unpackEntry(uint64_t data, uint8_t generation) {
+    TTEntry e;
+    e.value = (int32_t)(uint32_t)data;
+    e.move = (uint16_t)(data >> 32u);
+    e.depth = (uint8_t)(data >> 48u);
+    auto boundByte = (uint8_t)(data >> 56u);
+    e.bound = (boundByte >> 2u) == generation ? boundByte & 3u : BOUND_NONE;
+    return e;
+}
+
+TranspositionTable::TranspositionTable(size_t megabytes) {
+    resize(megabytes);
+}
+
+void TranspositionTable::resize(size_t megabytes) {
+    count = 1;
+    while (count * 2 * sizeof(TTBucket) <= megabytes * 1024 * 1024) {
+        count *= 2;
+    }
+    buckets.reset(new TTBucket[count]);
+    clear();
+}
+
+void TranspositionTable::clear() {
+    for (size_t i = 0; i < count; i++) {
+        for (TTSlot &slot : buckets[i].slots) {
+            slot.keyXorData.store(0, std::memory_order_relaxed);
+            slot.data.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void TranspositionTable::newGeneration() {
+    generation = (generation + 1) % TT_GENERATIONS;
+    if (generation == 0) {
+        clear();
+    }
+}
+
+bool TranspositionTable::probe(uint64_t hash, TTEntry &entry) const {
+    const TTBucket &bucket = buckets[hash & (count - 1)];
+    for (const TTSlot &slot : bucket.slots) {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        uint64_t keyXorData = slot.keyXorData.load(std::memory_order_relaxed);
+        if ((keyXorData ^ data) == hash) {
+            entry = unpackEntry(data, generation);
+            if (entry.bound != BOUND_NONE) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TranspositionTable::store(uint64_t hash, int depth, uint8_t bound, int value, uint16_t move) {
+    TTBucket &bucket = buckets[hash & (count - 1)];
+
+    TTSlot *replace = nullptr;
+    TTEntry replaceEntry{};
+    bool sameKey = false;
+    for (TTSlot &slot : bucket.slots) {
+        uint64_t data = slot.data.load(std::memory_order_relaxed);
+        uint64_t keyXorData = slot.keyXorData.load(std::memory_order_relaxed);
+        TTEntry e = unpackEntry(data, generation);
+        sameKey = (keyXorData ^ data) == hash && e.bound != BOUND_NONE;
+        if (e.bound == BOUND_NONE || sameKey) {
+            replace = &slot;
+            replaceEntry = e;
+            break;
+        }
+        if (replace == nullptr || e.depth < replaceEntry.depth) {
+            replace = &slot;
+            replaceEntry = e;
+        }
+    }
+
+    bool overwrite = replaceEntry.bound != BOUND_NONE && !sameKey;
+    if (sameKey && move == 0) {
+        move = replaceEntry.move;
+    }
+    uint64_t data = packEntry(TTEntry{move, (uint8_t)depth, bound, value}, generation);
+    replace->keyXorData.store(hash ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
+    return overwrite;
+}
@@ -0,0 +1,60 @@
+#ifndef CHESS_TRANSPOSITION_H
+#define CHESS_TRANSPOSITION_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+const uint8_t BOUND_NONE = 0;
+const uint8_t BOUND_EXACT = 1;
+const uint8_t BOUND_LOWER = 2;
+const uint8_t BOUND_UPPER = 3;
+
+const size_t DEFAULT_HASH_MB = 16;
+const int TT_BUCKET_SIZE = 4;
+// Generations fit in the six bits above the bound in a packed entry.
+const uint8_t TT_GENERATIONS = 64;
+
+struct TTEntry {
+    uint16_t move;
+    uint8_t depth;
+    uint8_t bound;
+    int value;
+};
+
+// Entries are two atomic words with the key stored xor'd with the data. The table is shared
+// between search threads without locks; a torn entry simply fails the key check.
+struct TTSlot {
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data;
+};
+
+// A bucket fills exactly one cache line, so a probe touches a single line of memory.
+struct alignas(64) TTBucket {
+    TTSlot slots[TT_BUCKET_SIZE];
+};
+
+class TranspositionTable {
+public:
+    explicit TranspositionTable(size_t megabytes = DEFAULT_HASH_MB);
+
+    void resize(size_t megabytes);
+    void clear();
+    // Empties the table for a new search without touching it: entries stored before read as empty.
+    // The generation wraps every TT_GENERATIONS calls, and the table is then cleared for real.
+    void newGeneration();
+
+    bool probe(uint64_t hash, TTEntry &entry) const;
+    // Returns true if a different position had to be evicted to make room.
+    bool store(uint64_t hash, int depth, uint8_t bound, int value, uint16_t move);
+
+    size_t bucketCount() const { return count; }
+
+private:
+    std::unique_ptr<TTBucket[]> buckets;
+    size_t count = 0;
+    uint8_t generation = 0;
+};
+
+#endif //CHESS_TRANSPOSITION_H
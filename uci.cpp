@@ -0,0 +1,310 @@
+#include "uci.h"
+#include "tablebase.h"
+#include "retrograde.h"
+
+std::string moveToUci(const Move &m) {
+    std::string s;
+    s += unAdjFile(m.startFile);
+    s += std::to_string(unAdjRank(m.startRank));
+    s += unAdjFile(m.destFile);
+    s += std::to_string(unAdjRank(m.destRank));
+    if (m.promoteType) {
+        s += pieceTypeToChar(m.promoteType);
+    }
+    return s;
+}
+
+// Accepts only moves the generator produces for the position, so malformed input and moves the board
+// can't represent (castling, en passant) are rejected.
+bool moveFromUci(const std::string &s, Board &b, Move &move) {
+    if (s.size() < 4 || s[0] < 'a' || s[0] > 'h' || s[1] < '1' || s[1] > '8' ||
+            s[2] < 'a' || s[2] > 'h' || s[3] < '1' || s[3] > '8') {
+        return false;
+    }
+    int sFile = adjFile(s[0]);
+    int sRank = adjRank(s[1] - '0');
+    int dFile = adjFile(s[2]);
+    int dRank = adjRank(s[3] - '0');
+    uint8_t promoteType = s.size() > 4 ? pieceTypeFromChar(s[4]) : 0;
+
+    BoardContext bc(b);
+    for (const Move &m : getMoves(b, bc)) {
+        if (m.startRank == sRank && m.startFile == sFile && m.destRank == dRank && m.destFile == dFile &&
+                m.promoteType == promoteType) {
+            move = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+UciEngine::UciEngine() : board(START_FEN), tt(DEFAULT_HASH_MB),
+                         bookRng(std::chrono::steady_clock::now().time_since_epoch().count()) {
+    control.onIteration = [this](const SearchInfo &info) {
+        sendInfo(info);
+    };
+}
+
+UciEngine::~UciEngine() {
+    stopSearch();
+}
+
+void UciEngine::send(const std::string &line) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << line << std::endl;
+}
+
+void UciEngine::sendInfo(const SearchInfo &info) {
+    std::ostringstream line;
+    line << "info depth " << info.depth;
+    if (multiPv > 1) {
+        line << " multipv " << info.multiPv;
+    }
+    line << " score ";
+    if (isMateValue(info.value)) {
+        line << "mate " << (info.value > 0 ? movesToMate(info.value) : -movesToMate(info.value));
+    } else {
+        line << "cp " << info.value;
+    }
+    line << " nodes " << info.nodes << " nps " << (info.elapsedMillis > 0 ? info.nodes * 1000 / info.elapsedMillis : 0)
+         << " time " << info.elapsedMillis << " tbhits " << info.tbHits << " pv";
+    for (const Move &m : info.pv) {
+        line << ' ' << moveToUci(m);
+    }
+    send(line.str());
+}
+
+void UciEngine::loop(std::istream &in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream args(line);
+        std::string command;
+        args >> command;
+
+        if (command == "uci") {
+            send("id name chess");
+            send("id author the chess authors");
+            send("option name Hash type spin default " + std::to_string(DEFAULT_HASH_MB) + " min 1 max 65536");
+            send("option name Threads type spin default 1 min 1 max 256");
+            send("option name Ponder type check default false");
+            send("option name MultiPV type spin default 1 min 1 max " + std::to_string(MAX_MOVES));
+            send("option name EvalFile type string default <empty>");
+            send("option name NullMove type check default true");
+            send("option name LateMoveReductions type check default true");
+            send("option name Futility type check default true");
+            send("option name TablebasePath type string default <empty>");
+            send("option name GenerateTablebases type spin default 0 min 0 max 4");
+            send("option name OwnBook type check default false");
+            send("option name BookFile type string default <empty>");
+            send("option name BookBestMove type check default false");
+            send("option name Clear Hash type button");
+            send("uciok");
+        } else if (command == "isready") {
+            send("readyok");
+        } else if (command == "setoption") {
+            setOption(args);
+        } else if (command == "ucinewgame") {
+            stopSearch();
+            tt.clear();
+        } else if (command == "position") {
+            position(args);
+        } else if (command == "go") {
+            go(args);
+        } else if (command == "stop") {
+            stopSearch();
+        } else if (command == "ponderhit") {
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                control.pondering = false;
+            }
+            stateChanged.notify_all();
+        } else if (command == "quit") {
+            break;
+        }
+    }
+    stopSearch();
+}
+
+void UciEngine::setOption(std::istringstream &args) {
+    std::string token;
+    std::string name;
+    std::string value;
+    args >> token;
+    while (args >> token && token != "value") {
+        name += (name.empty() ? "" : " ") + token;
+    }
+    while (args >> token) {
+        value += (value.empty() ? "" : " ") + token;
+    }
+
+    stopSearch();
+    if (name == "Hash") {
+        tt.resize(std::stoul(value));
+    } else if (name == "Threads") {
+        threads = std::max(1, std::stoi(value));
+    } else if (name == "MultiPV") {
+        multiPv = std::max(1, std::min(std::stoi(value), (int)MAX_MOVES));
+    } else if (name == "NullMove") {
+        features.nullMove = value == "true";
+    } else if (name == "LateMoveReductions") {
+        features.lateMoveReductions = value == "true";
+    } else if (name == "Futility") {
+        features.futility = value == "true";
+    } else if (name == "TablebasePath") {
+        int loaded = loadTablebases(value == "<empty>" ? "" : value);
+        send("info string loaded " + std::to_string(loaded) + " tablebases");
+    } else if (name == "GenerateTablebases") {
+        // Solves every table up to this many pieces in memory, on the search threads.
+        std::vector<GenerationResult> results;
+        for (const std::string &table : tablebaseNames(std::stoi(value))) {
+            generateTablebase(table, threads, results);
+        }
+        send("info string generated " + std::to_string(results.size()) + " tablebases");
+    } else if (name == "OwnBook") {
+        ownBook = value == "true";
+    } else if (name == "BookFile") {
+        if (value.empty() || value == "<empty>") {
+            book.close();
+        } else if (!book.open(value)) {
+            send("info string could not open book " + value);
+        }
+    } else if (name == "BookBestMove") {
+        bookSelection = value == "true" ? BOOK_SELECT_BEST : BOOK_SELECT_WEIGHTED;
+    } else if (name == "Clear Hash") {
+        tt.clear();
+    } else if (name == "EvalFile") {
+        if (value.empty() || value == "<empty>") {
+            setActiveNetwork(nullptr);
+        } else if (!loadNetwork(value)) {
+            send("info string could not load network " + value);
+        }
+    }
+}
+
+// The new board is built aside and only replaces the current one once the FEN and every move are
+// accepted. A rejected command leaves no position, so a following go doesn't search one the GUI
+// never sent.
+void UciEngine::position(std::istringstream &args) {
+    std::string token;
+    std::string fen;
+    args >> token;
+    if (token == "startpos") {
+        fen = START_FEN;
+        args >> token;
+    } else if (token == "fen") {
+        while (args >> token && token != "moves") {
+            fen += (fen.empty() ? "" : " ") + token;
+        }
+    }
+
+    stopSearch();
+    positionValid = false;
+    if (!isValidFen(fen)) {
+        send("info string invalid position " + fen);
+        return;
+    }
+    Board next(fen);
+    if (token == "moves") {
+        while (args >> token) {
+            Move m;
+            if (!moveFromUci(token, next, m)) {
+                send("info string unsupported or illegal move " + token);
+                return;
+            }
+            next.doMove(m);
+        }
+    }
+    board = next;
+    positionValid = true;
+}
+
+void UciEngine::go(std::istringstream &args) {
+    SearchLimits limits;
+    limits.threads = threads;
+    limits.multiPv = multiPv;
+    limits.features = features;
+    bool infinite = false;
+    std::string token;
+    while (args >> token) {
+        if (token == "infinite") {
+            infinite = true;
+        } else if (token == "ponder") {
+            limits.ponder = true;
+        } else if (token == "wtime" || token == "btime") {
+            long millis;
+            args >> millis;
+            if ((token == "wtime") == board.whiteToMove) {
+                limits.timeLeftMillis = std::max(1L, millis);
+            }
+        } else if (token == "winc" || token == "binc") {
+            long millis;
+            args >> millis;
+            if ((token == "winc") == board.whiteToMove) {
+                limits.incrementMillis = millis;
+            }
+        } else if (token == "movestogo") {
+            args >> limits.movesToGo;
+        } else if (token == "movetime") {
+            args >> limits.moveTimeMillis;
+        } else if (token == "depth") {
+            args >> limits.depth;
+        } else if (token == "nodes") {
+            args >> limits.nodes;
+        }
+    }
+
+    stopSearch();
+    if (!positionValid) {
+        send("info string no position to search");
+        send("bestmove 0000");
+        return;
+    }
+    // A book move is answered right away, unless the GUI expects the search to keep going.
+    Move bookMove;
+    if (ownBook && !infinite && !limits.ponder && book.pickMove(board, bookSelection, bookRng, bookMove)) {
+        send("bestmove " + moveToUci(bookMove));
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopRequested = false;
+        control.stop = false;
+        control.pondering = limits.ponder;
+    }
+    searchThread = std::thread(&UciEngine::search, this, board, limits, infinite);
+}
+
+// bestmove may not be sent during go infinite or before ponderhit, even if the search is already done.
+void UciEngine::search(Board b, SearchLimits limits, bool infinite) {
+    Evaluation e = evaluateBoard(b, limits, tt, &control);
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        stateChanged.wait(lock, [&] {
+            return stopRequested || (!infinite && !control.pondering);
+        });
+    }
+
+    std::string line = "bestmove ";
+    if (e.pos.bestMovePath.empty()) {
+        line += "0000";
+    } else {
+        line += moveToUci(e.pos.bestMovePath[0]);
+        if (e.pos.bestMovePath.size() > 1) {
+            line += " ponder " + moveToUci(e.pos.bestMovePath[1]);
+        }
+    }
+    send(line);
+}
+
+void UciEngine::stopSearch() {
+    if (!searchThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopRequested = true;
+        control.stop = true;
+    }
+    stateChanged.notify_all();
+    searchThread.join();
+}
@@ -0,0 +1,55 @@
+#ifndef CHESS_UCI_H
+#define CHESS_UCI_H
+
+#include <condition_variable>
+#include <istream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "chess.h"
+#include "book.h"
+
+std::string moveToUci(const Move &m);
+bool moveFromUci(const std::string &s, Board &b, Move &move);
+
+// UCI front end. Commands are read on the calling thread while the search runs on its own thread, so
+// stop, ponderhit and isready are answered while searching. Castling and en passant aren't
+// supported by the board, so positions or moves that need them are rejected with an info string,
+// and go answers bestmove 0000 until a position is accepted.
+class UciEngine {
+public:
+    UciEngine();
+    ~UciEngine();
+
+    void loop(std::istream &in);
+
+private:
+    void send(const std::string &line);
+    void sendInfo(const SearchInfo &info);
+    void setOption(std::istringstream &args);
+    void position(std::istringstream &args);
+    void go(std::istringstream &args);
+    void search(Board b, SearchLimits limits, bool infinite);
+    void stopSearch();
+
+    Board board;
+    bool positionValid = true;
+    TranspositionTable tt;
+    int threads = 1;
+    int multiPv = 1;
+    SearchFeatures features;
+    OpeningBook book;
+    bool ownBook = false;
+    int bookSelection = BOOK_SELECT_WEIGHTED;
+    uint64_t bookRng;
+
+    SearchControl control;
+    std::thread searchThread;
+    std::mutex outputMutex;
+    std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    bool stopRequested = false;
+};
+
+#endif //CHESS_UCI_H